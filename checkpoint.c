@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "procstat.h"
+#include "sched.h"
+
+struct checkpoint_record *checkpoint = NULL;
+
+static struct checkpoint_header *header;
+static size_t map_size;
+static char state_path[4096];
+static int state_fd = -1;
+
+// FNV-1a over each job's arguments, NUL separated
+static uint64_t hash_batch(struct job_table *table){
+  uint64_t hash = 14695981039346656037ULL;
+  for(int i = 0; i < table->count; i++){
+    for(char **arg = table->jobs[i].argv; *arg; arg++){
+      for(const char *p = *arg; ; p++){
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+        if(*p == '\0'){
+          break;
+        }
+      }
+    }
+    hash = (hash ^ '\n') * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Maps the state file, creating it for a fresh run. resumed is set when it
+// already held this batch. The lock goes with us, so a second part5 on the
+// same file is turned away while the first is alive.
+int checkpoint_open(const char *path, struct job_table *table, int *resumed){
+  snprintf(state_path, sizeof(state_path), "%s", path);
+  state_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(state_fd < 0){
+    fprintf(stderr, "Error: cannot open state file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if(flock(state_fd, LOCK_EX | LOCK_NB) < 0){
+    fprintf(stderr, "Error: %s is in use by another scheduler\n", path);
+    return -1;
+  }
+
+  struct stat st;
+  fstat(state_fd, &st);
+  map_size = sizeof(struct checkpoint_header) + (size_t)table->count * sizeof(struct checkpoint_record);
+  uint64_t hash = hash_batch(table);
+  *resumed = st.st_size > 0;
+
+  if(*resumed){
+    struct checkpoint_header existing;
+    if(pread(state_fd, &existing, sizeof(existing), 0) != sizeof(existing) ||
+       memcmp(existing.magic, CHECKPOINT_MAGIC, sizeof(existing.magic)) != 0 ||
+       existing.record_size != sizeof(struct checkpoint_record) ||
+       (size_t)st.st_size != map_size){
+      fprintf(stderr, "Error: %s is not a part5 state file for this batch\n", path);
+      return -1;
+    }
+    if(existing.count != (uint32_t)table->count || existing.batch_hash != hash){
+      fprintf(stderr, "Error: %s was written for a different batch\n", path);
+      return -1;
+    }
+  }else if(ftruncate(state_fd, map_size) < 0){
+    fprintf(stderr, "Error: cannot size state file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  header = (struct checkpoint_header *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, state_fd, 0);
+  if(header == MAP_FAILED){
+    perror("Failed to map state file");
+    return -1;
+  }
+  checkpoint = (struct checkpoint_record *)(header + 1);
+
+  if(!*resumed){
+    // Records are already zero, which is JOB_PENDING. The magic goes in
+    // last so a file cut short by a crash here is never taken for valid.
+    header->record_size = sizeof(struct checkpoint_record);
+    header->count = table->count;
+    header->batch_hash = hash;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+  }
+  return 0;
+}
+
+// The child is still parked before exec, its start time is already final
+void checkpoint_launch(struct task *task){
+  if(checkpoint == NULL){
+    return;
+  }
+  struct checkpoint_record *record = &checkpoint[task->index];
+  struct proc_stat stat;
+  record->starttime = read_proc_stat(-1, task->pid, &stat) == 0 ? stat.starttime : 0;
+  record->pid = task->pid;
+  record->cpu_ns = 0;
+  record->state = JOB_LAUNCHED;
+}
+
+void checkpoint_save(struct task *task){
+  if(checkpoint == NULL){
+    return;
+  }
+  struct checkpoint_record *record = &checkpoint[task->index];
+  record->cpu_ns = task->last_cpu_ns;
+  record->slice = task->slice;
+  record->level = task->level;
+  record->vruntime = task->vruntime;
+}
+
+void checkpoint_finish(struct task *task, int status){
+  if(checkpoint == NULL){
+    return;
+  }
+  checkpoint[task->index].status = status;
+  checkpoint[task->index].state = JOB_DONE;
+}
+
+// A batch that ran to the end has nothing to resume, its file goes
+void checkpoint_close(int complete){
+  if(checkpoint == NULL){
+    return;
+  }
+  munmap(header, map_size);
+  checkpoint = NULL;
+  if(complete){
+    unlink(state_path);
+  }
+  close(state_fd);
+}
@@ -0,0 +1,51 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "jobs.h"
+
+struct task;
+
+// The job table as a memory-mapped state file (--state). Every launch,
+// preemption and exit is a plain store into the mapping, which the kernel
+// keeps even if we die, so a restarted part5 can take the batch up again:
+// finished jobs are skipped, jobs still alive are re-attached and the rest
+// are launched again.
+
+#define CHECKPOINT_MAGIC "P5STATE1"
+
+enum checkpoint_state {
+  JOB_PENDING, // Never launched
+  JOB_LAUNCHED,
+  JOB_DONE,
+};
+
+struct checkpoint_header {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t count; // Jobs in the batch
+  uint64_t batch_hash; // Of every job's argv, a different batch is refused
+};
+
+struct checkpoint_record {
+  int32_t pid;
+  uint16_t state;
+  uint16_t level; // MLFQ level
+  int32_t status; // Wait status once done, -1 if it exited while adopted, -2 if skipped
+  int32_t unused;
+  uint64_t starttime; // Field 22 of /proc/<pid>/stat, tells a survivor from a reused pid
+  int64_t cpu_ns; // CPU time as of its last preemption
+  int64_t slice;
+  int64_t vruntime;
+};
+
+extern struct checkpoint_record *checkpoint; // One per job, NULL without --state
+
+int checkpoint_open(const char *path, struct job_table *table, int *resumed);
+void checkpoint_launch(struct task *task);
+void checkpoint_save(struct task *task);
+void checkpoint_finish(struct task *task, int status);
+void checkpoint_close(int complete);
+
+#endif
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "control.h"
+#include "sched.h"
+
+#define CPU_PERIOD 100000 // cpu.max period in us
+#define MIN_QUOTA 1000 // The kernel rejects quotas under 1ms
+
+static void signal_stop(struct task *task){
+  kill(task->pid, SIGSTOP);
+}
+
+static void signal_resume(struct task *task){
+  kill(task->pid, SIGCONT);
+}
+
+static int signal_attach(struct task *task){
+  return 0;
+}
+
+static void signal_nothing(struct task *task){
+}
+
+struct control signal_control = {
+  .name = "signal",
+  .attach = signal_attach,
+  .start = signal_nothing, // The launcher leaves every job SIGSTOPped
+  .stop = signal_stop,
+  .resume = signal_resume,
+  .release = signal_nothing,
+};
+
+// Every job of this run lives in <root>/part5.<pid>/job<index>. With a share
+// set, preempted jobs are throttled through cpu.max instead of frozen.
+static char run_dir[4096];
+static int cpu_share;
+static char throttled[32];
+
+static int write_file(const char *path, const char *text){
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if(fd < 0){
+    return -1;
+  }
+  ssize_t len = write(fd, text, strlen(text));
+  close(fd);
+  return len < 0 ? -1 : 0;
+}
+
+// cgroupfs takes a whole value per write, the offset does not matter
+static void write_value(int fd, const char *text){
+  if(fd >= 0){
+    pwrite(fd, text, strlen(text), 0);
+  }
+}
+
+int cgroup_setup(const char *root, int share){
+  char path[4200];
+
+  cpu_share = share;
+  snprintf(run_dir, sizeof(run_dir), "%s/part5.%d", root, getpid());
+  if(mkdir(run_dir, 0755) < 0){
+    fprintf(stderr, "Error: cannot create cgroup %s: %s\n", run_dir, strerror(errno));
+    return -1;
+  }
+
+  if(share > 0){
+    long quota = (long)CPU_PERIOD * share / 100;
+    snprintf(throttled, sizeof(throttled), "%ld %d", quota > MIN_QUOTA ? quota : MIN_QUOTA, CPU_PERIOD);
+
+    // cpu.max only shows up in the job directories once both levels above
+    // hand the cpu controller down
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", root);
+    write_file(path, "+cpu");
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", run_dir);
+    if(write_file(path, "+cpu") < 0){
+      fprintf(stderr, "Error: cannot enable the cpu controller under %s: %s\n", run_dir, strerror(errno));
+      rmdir(run_dir);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void cgroup_cleanup(){
+  if(run_dir[0] != '\0' && rmdir(run_dir) < 0){
+    fprintf(stderr, "Warning: cannot remove %s: %s\n", run_dir, strerror(errno));
+  }
+}
+
+// A file in the job's own cgroup, e.g. cpu.stat for the cgroup stats source
+int cgroup_open_file(struct task *task, const char *name, int flags){
+  char path[4300];
+  snprintf(path, sizeof(path), "%s/job%d/%s", run_dir, task->index, name);
+  return open(path, flags | O_CLOEXEC);
+}
+
+static int cgroup_attach(struct task *task){
+  char dir[4200];
+  char path[4300];
+  char pid[16];
+
+  snprintf(dir, sizeof(dir), "%s/job%d", run_dir, task->index);
+  if(mkdir(dir, 0755) < 0){
+    fprintf(stderr, "Error: cannot create cgroup %s: %s\n", dir, strerror(errno));
+    return -1;
+  }
+
+  // The job is still parked before exec, so anything it forks is born here
+  snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+  snprintf(pid, sizeof(pid), "%d", task->pid);
+  if(write_file(path, pid) < 0){
+    fprintf(stderr, "Error: cannot move %d into %s: %s\n", task->pid, dir, strerror(errno));
+    return -1;
+  }
+
+  const char *name = cpu_share > 0 ? "cpu.max" : "cgroup.freeze";
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  task->control_fd = open(path, O_WRONLY | O_CLOEXEC);
+  if(task->control_fd < 0){
+    fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void cgroup_stop(struct task *task){
+  write_value(task->control_fd, cpu_share > 0 ? throttled : "1");
+}
+
+static void cgroup_resume(struct task *task){
+  write_value(task->control_fd, cpu_share > 0 ? "max" : "0");
+}
+
+// Swap the launcher's SIGSTOP for our own hold, the SIGCONT takes effect
+// under the freeze or the throttle
+static void cgroup_start(struct task *task){
+  cgroup_stop(task);
+  kill(task->pid, SIGCONT);
+}
+
+// Leftover descendants are let go rather than left frozen, their directory
+// stays until they exit
+static void cgroup_release(struct task *task){
+  char dir[4200];
+
+  cgroup_resume(task);
+  if(task->control_fd >= 0){
+    close(task->control_fd);
+    task->control_fd = -1;
+  }
+  snprintf(dir, sizeof(dir), "%s/job%d", run_dir, task->index);
+  rmdir(dir);
+}
+
+struct control cgroup_control = {
+  .name = "cgroup",
+  .attach = cgroup_attach,
+  .start = cgroup_start,
+  .stop = cgroup_stop,
+  .resume = cgroup_resume,
+  .release = cgroup_release,
+};
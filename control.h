@@ -0,0 +1,26 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+struct task;
+
+// How a task is taken off and put back on the CPU. The signal backend stops
+// the direct child only. The cgroup backend moves each job into its own
+// cgroup v2 directory before it execs, so everything it forks is frozen and
+// thawed with it.
+struct control {
+  const char *name;
+  int (*attach)(struct task *task); // After launch, before the job is released
+  void (*start)(struct task *task); // Once released, hold the job until dispatched
+  void (*stop)(struct task *task);
+  void (*resume)(struct task *task);
+  void (*release)(struct task *task); // The job's main process has exited
+};
+
+extern struct control signal_control;
+extern struct control cgroup_control;
+
+int cgroup_setup(const char *root, int share);
+void cgroup_cleanup();
+int cgroup_open_file(struct task *task, const char *name, int flags);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+#include "graph.h"
+#include "sched.h"
+
+static int *dependents; // Every task's dependents[] back to back
+
+// Fills in each task's dependents, how many jobs it still waits for and its
+// critical path. Jobs only wait for earlier lines, so a single pass from the
+// end sees every dependent's path before the jobs it waits for.
+int graph_init(struct job_table *table, struct task *tasks){
+  int count = table->count;
+  dependents = (int *)malloc((table->num_deps > 0 ? table->num_deps : 1) * sizeof(int));
+  if(!dependents){
+    perror("Failed to allocate dependency graph");
+    return -1;
+  }
+
+  for(int i = 0; i < count; i++){
+    tasks[i].waiting_on = table->jobs[i].num_after;
+    for(int k = 0; k < table->jobs[i].num_after; k++){
+      tasks[table->jobs[i].after[k]].num_dependents++;
+    }
+  }
+  int *out = dependents;
+  for(int i = 0; i < count; i++){
+    tasks[i].dependents = out;
+    out += tasks[i].num_dependents;
+    tasks[i].num_dependents = 0; // Counted again as they are filled in
+  }
+  for(int i = 0; i < count; i++){
+    for(int k = 0; k < table->jobs[i].num_after; k++){
+      struct task *before = &tasks[table->jobs[i].after[k]];
+      before->dependents[before->num_dependents++] = i;
+    }
+  }
+
+  for(int i = count - 1; i >= 0; i--){
+    struct task *task = &tasks[i];
+    long long longest = 0;
+    for(int k = 0; k < task->num_dependents; k++){
+      long long path = tasks[task->dependents[k]].path_ns;
+      longest = path > longest ? path : longest;
+    }
+    task->path_ns = (task->runtime > 0 ? task->runtime : config.quantum) + longest;
+  }
+  return 0;
+}
+
+// A job is known by its @id= when it has one and by its command otherwise,
+// so the same step keeps its history when lines are added around it
+static uint64_t job_key(struct job *job){
+  uint64_t hash = 14695981039346656037ULL;
+  if(job->id){
+    for(const char *p = job->id; *p; p++){
+      hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    return hash;
+  }
+  for(char **arg = job->argv; *arg; arg++){
+    for(const char *p = *arg; ; p++){
+      hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+      if(*p == '\0'){
+        break;
+      }
+    }
+  }
+  return hash;
+}
+
+struct history_entry {
+  uint64_t key;
+  long long runtime;
+  char name[64]; // For whoever reads the file, never matched on
+};
+
+static struct history_entry *history;
+static int history_count;
+static int history_capacity;
+
+static int by_key(const void *a, const void *b){
+  uint64_t x = ((const struct history_entry *)a)->key;
+  uint64_t y = ((const struct history_entry *)b)->key;
+  return x < y ? -1 : x > y;
+}
+
+// Among the first count entries, which are the sorted ones
+static struct history_entry *history_find(uint64_t key, int count){
+  struct history_entry probe = {.key = key};
+  return (struct history_entry *)bsearch(&probe, history, count, sizeof(probe), by_key);
+}
+
+// One "<key> <cpu ns> <name>" line per job ever seen. Jobs without an
+// @runtime= take theirs from here. A missing file is an empty history.
+int history_load(const char *path, struct job_table *table, struct task *tasks){
+  history_capacity = table->count + 64;
+  history = (struct history_entry *)malloc(history_capacity * sizeof(struct history_entry));
+  if(!history){
+    perror("Failed to allocate runtime history");
+    return -1;
+  }
+
+  FILE *file = fopen(path, "r");
+  if(!file){
+    if(errno == ENOENT){
+      return 0;
+    }
+    fprintf(stderr, "Error: cannot read history file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct history_entry entry;
+  unsigned long long key;
+  while(fscanf(file, "%llx %lld %63s%*[^\n]", &key, &entry.runtime, entry.name) == 3){
+    if(history_count == history_capacity){
+      history_capacity *= 2;
+      struct history_entry *grown = (struct history_entry *)realloc(history, history_capacity * sizeof(entry));
+      if(!grown){
+        perror("Failed to grow runtime history");
+        fclose(file);
+        return -1;
+      }
+      history = grown;
+    }
+    entry.key = key;
+    history[history_count++] = entry;
+  }
+  fclose(file);
+  qsort(history, history_count, sizeof(struct history_entry), by_key);
+
+  int known = 0;
+  for(int i = 0; i < table->count; i++){
+    struct history_entry *found = history_find(job_key(&table->jobs[i]), history_count);
+    if(found && found->runtime > 0 && tasks[i].runtime == 0){
+      tasks[i].runtime = found->runtime;
+      known++;
+    }
+  }
+  printf("History: runtimes for %d of %d jobs from %s\n", known, table->count, path);
+  return 0;
+}
+
+// Folds in the CPU time of every job that exited cleanly, averaged with what
+// was known, and writes the file out again through a rename so a crash never
+// leaves it half written
+int history_save(const char *path, struct job_table *table, struct task *tasks){
+  int loaded = history_count;
+  for(int i = 0; i < table->count; i++){
+    struct task *task = &tasks[i];
+    // Only jobs this run launched and reaped have an exact figure
+    if(task->pid == 0 || task->adopted || !WIFEXITED(task->status) || WEXITSTATUS(task->status) != 0){
+      continue;
+    }
+    uint64_t key = job_key(&table->jobs[i]);
+    struct history_entry *found = history_find(key, loaded);
+    if(found){
+      found->runtime = (found->runtime + task->last_cpu_ns) / 2;
+      continue;
+    }
+    if(history_count == history_capacity){
+      history_capacity *= 2;
+      struct history_entry *grown = (struct history_entry *)realloc(history, history_capacity * sizeof(struct history_entry));
+      if(!grown){
+        perror("Failed to grow runtime history");
+        return -1;
+      }
+      history = grown;
+    }
+    struct history_entry *entry = &history[history_count++];
+    entry->key = key;
+    entry->runtime = task->last_cpu_ns;
+    const char *name = table->jobs[i].id ? table->jobs[i].id : table->jobs[i].argv[0];
+    snprintf(entry->name, sizeof(entry->name), "%s", *name ? name : "-");
+    for(char *p = entry->name; *p; p++){
+      if(*p == ' ' || *p == '\t' || *p == '\n'){
+        *p = '_';
+      }
+    }
+  }
+
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *file = fopen(tmp, "w");
+  if(!file){
+    fprintf(stderr, "Error: cannot write history file %s: %s\n", tmp, strerror(errno));
+    return -1;
+  }
+  for(int i = 0; i < history_count; i++){
+    fprintf(file, "%016llx %lld %s\n", (unsigned long long)history[i].key, history[i].runtime, history[i].name);
+  }
+  if(fclose(file) != 0 || rename(tmp, path) < 0){
+    fprintf(stderr, "Error: cannot write history file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  free(history);
+  return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "jobs.h"
+
+struct task;
+
+// The @after= graph of a batch as part5 runs it. Each job is released once
+// everything it waits for has finished, and ready jobs are taken longest
+// critical path first: a job's path is its own expected runtime plus the
+// longest chain of jobs that wait on it, directly or not. Runtimes come from
+// @runtime=, then from the --history file of earlier runs, and a job with
+// neither counts as one quantum.
+
+int graph_init(struct job_table *table, struct task *tasks);
+int history_load(const char *path, struct job_table *table, struct task *tasks);
+int history_save(const char *path, struct job_table *table, struct task *tasks);
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jobs.h"
+
+#define INITIAL_JOBS 64
+#define INITIAL_ARGS 256
+
+static int is_space(char c){
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int grow(void **array, int *capacity, int needed, size_t size){
+  if(needed <= *capacity){
+    return 0;
+  }
+  int new_capacity = *capacity;
+  while(new_capacity < needed){
+    new_capacity *= 2;
+  }
+  void *grown = realloc(*array, (size_t)new_capacity * size);
+  if(!grown){
+    perror("Failed to grow job table");
+    return -1;
+  }
+  *array = grown;
+  *capacity = new_capacity;
+  return 0;
+}
+
+static int push_arg(struct job_table *table, char *arg){
+  if(grow((void **)&table->args, &table->args_capacity, table->num_args + 1, sizeof(char *)) < 0){
+    return -1;
+  }
+  table->args[table->num_args++] = arg;
+  return 0;
+}
+
+// Parses "250us", "5ms", "1s" or "750000ns" into ns, a bare number is taken as us
+long long parse_duration(const char *text){
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 10);
+  if(errno != 0 || end == text || value < 0){
+    return -1;
+  }
+
+  long long scale;
+  if(strcmp(end, "ns") == 0){
+    scale = 1;
+  }else if(strcmp(end, "us") == 0 || *end == '\0'){
+    scale = 1000LL;
+  }else if(strcmp(end, "ms") == 0){
+    scale = 1000000LL;
+  }else if(strcmp(end, "s") == 0){
+    scale = 1000000000LL;
+  }else{
+    return -1;
+  }
+
+  if(value > INT64_MAX / scale){
+    return -1;
+  }
+  return value * scale;
+}
+
+// Byte counts with an optional K, M or G suffix (powers of 1024)
+long long parse_size(const char *text){
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 10);
+  if(errno != 0 || end == text || value < 0){
+    return -1;
+  }
+
+  int shift;
+  switch(*end){
+    case '\0':
+      shift = 0;
+      break;
+    case 'K': case 'k':
+      shift = 10;
+      break;
+    case 'M': case 'm':
+      shift = 20;
+      break;
+    case 'G': case 'g':
+      shift = 30;
+      break;
+    default:
+      return -1;
+  }
+  if(*end != '\0' && end[1] != '\0'){
+    return -1;
+  }
+
+  if(value > INT64_MAX >> shift){
+    return -1;
+  }
+  return value << shift;
+}
+
+// Leading @key=value tokens are scheduling hints rather than part of the
+// command, e.g. "@nice=5 ./cpubound" or "@deadline=30s @runtime=2s ./job".
+// They are taken off the front of argv. "@id=fetch" names a job and
+// "@after=fetch,unpack" holds it back until the named jobs have finished.
+static int take_annotations(struct job_table *table, struct job *job, const char *filename){
+  char **argv = table->args + (long)job->argv; // Still an index here
+  int taken = 0;
+
+  while(taken < job->argc && argv[taken][0] == '@'){
+    const char *token = argv[taken];
+    char *end;
+    if(strncmp(token, "@nice=", 6) == 0){
+      long nice = strtol(token + 6, &end, 10);
+      if(end == token + 6 || *end != '\0' || nice < -20 || nice > 19){
+        fprintf(stderr, "Error: %s:%d: invalid nice value '%s'\n", filename, job->line, token);
+        return -1;
+      }
+      job->nice = (int)nice;
+    }else if(strncmp(token, "@deadline=", 10) == 0 || strncmp(token, "@runtime=", 9) == 0){
+      const char *value = strchr(token, '=') + 1;
+      long long ns = parse_duration(value);
+      if(ns <= 0){
+        fprintf(stderr, "Error: %s:%d: invalid duration '%s'\n", filename, job->line, token);
+        return -1;
+      }
+      if(token[1] == 'd'){
+        job->deadline = ns;
+      }else{
+        job->runtime = ns;
+      }
+    }else if(strncmp(token, "@id=", 4) == 0){
+      if(token[4] == '\0' || strchr(token + 4, ',') || job->id){
+        fprintf(stderr, "Error: %s:%d: invalid job id '%s'\n", filename, job->line, token);
+        return -1;
+      }
+      job->id = token + 4;
+    }else if(strncmp(token, "@after=", 7) == 0){
+      if(token[7] == '\0' || job->after_names){
+        fprintf(stderr, "Error: %s:%d: invalid dependency list '%s'\n", filename, job->line, token);
+        return -1;
+      }
+      job->after_names = argv[taken] + 7;
+      job->num_after = 1;
+      for(char *p = job->after_names; *p; p++){
+        if(*p == ','){
+          *p = '\0';
+          job->num_after++;
+        }
+      }
+      table->num_deps += job->num_after;
+    }else{
+      fprintf(stderr, "Error: %s:%d: unknown annotation '%s'\n", filename, job->line, token);
+      return -1;
+    }
+    taken++;
+  }
+
+  if(taken == job->argc){
+    fprintf(stderr, "Error: %s:%d: annotations without a command\n", filename, job->line);
+    return -1;
+  }
+  job->argv = (char **)((long)job->argv + taken);
+  job->argc -= taken;
+  return 0;
+}
+
+// Orders jobs by @id= for qsort and bsearch
+static int by_id(const void *a, const void *b){
+  return strcmp((*(struct job * const *)a)->id, (*(struct job * const *)b)->id);
+}
+
+// Turns each job's @after= names into indices once every @id= is known. A
+// job may only wait for jobs above it, which keeps the graph free of cycles
+// and makes line order one valid order to run it in.
+static int resolve_dependencies(struct job_table *table, const char *filename){
+  int num_ids = 0;
+  struct job **ids = (struct job **)malloc((table->count > 0 ? table->count : 1) * sizeof(struct job *));
+  table->deps = (int *)malloc((table->num_deps > 0 ? table->num_deps : 1) * sizeof(int));
+  if(!ids || !table->deps){
+    perror("Failed to allocate dependency table");
+    free(ids);
+    return -1;
+  }
+  for(int i = 0; i < table->count; i++){
+    if(table->jobs[i].id){
+      ids[num_ids++] = &table->jobs[i];
+    }
+  }
+  qsort(ids, num_ids, sizeof(struct job *), by_id);
+  for(int i = 1; i < num_ids; i++){
+    if(strcmp(ids[i - 1]->id, ids[i]->id) == 0){
+      // qsort is not stable, the two may have come out either way round
+      struct job *first = ids[i]->line < ids[i - 1]->line ? ids[i] : ids[i - 1];
+      struct job *again = first == ids[i] ? ids[i - 1] : ids[i];
+      fprintf(stderr, "Error: %s:%d: job id '%s' already used on line %d\n",
+        filename, again->line, again->id, first->line);
+      free(ids);
+      return -1;
+    }
+  }
+
+  int *out = table->deps;
+  for(int i = 0; i < table->count; i++){
+    struct job *job = &table->jobs[i];
+    const char *name = job->after_names;
+    job->after = out;
+    for(int k = 0; k < job->num_after; k++, name += strlen(name) + 1){
+      struct job key = {.id = name};
+      struct job *keyp = &key;
+      struct job **found = (struct job **)bsearch(&keyp, ids, num_ids, sizeof(struct job *), by_id);
+      int index = found ? (int)(*found - table->jobs) : -1;
+      if(index < 0 || index >= i){
+        fprintf(stderr, "Error: %s:%d: @after= names '%s', which is not %s\n", filename, job->line,
+          name, index < 0 ? "the @id= of any job" : "on an earlier line");
+        free(ids);
+        return -1;
+      }
+      *out++ = index;
+    }
+  }
+  free(ids);
+  return 0;
+}
+
+// Parses the file in a single sequential pass over an mmap of it. Tokens are
+// split on blanks; '...' is literal, "..." and a bare backslash escape the
+// next character, a backslash-newline continues the line and # starts a
+// comment. Unquoted text never grows, so the arena is sized once from the
+// file and argv pointers into it stay valid while the tables grow.
+int load_job_file(const char *filename, struct job_table *table){
+  memset(table, 0, sizeof(*table));
+
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    perror("Error opening file");
+    return -1;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0){
+    perror("Error reading file");
+    close(fd);
+    return -1;
+  }
+
+  size_t size = st.st_size;
+  const char *map = NULL;
+  if(size > 0){
+    map = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+      perror("Error mapping file");
+      close(fd);
+      return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  table->text = (char *)malloc(size + 1);
+  table->jobs = (struct job *)malloc(INITIAL_JOBS * sizeof(struct job));
+  table->args = (char **)malloc(INITIAL_ARGS * sizeof(char *));
+  table->jobs_capacity = INITIAL_JOBS;
+  table->args_capacity = INITIAL_ARGS;
+  if(!table->text || !table->jobs || !table->args){
+    perror("Failed to allocate memory for job table");
+    goto fail;
+  }
+
+  char *out = table->text;
+  int line = 1;
+  int in_token = 0;
+  char quote = 0;
+  struct job *job = NULL;
+
+  for(size_t i = 0; i <= size; i++){
+    char c = (i < size) ? map[i] : '\0';
+    int escaped = 0;
+
+    if(quote){
+      if(c == '\0'){
+        fprintf(stderr, "Error: %s:%d: unterminated quote\n", filename, line);
+        goto fail;
+      }
+      if(c == quote){
+        quote = 0;
+      }else if(quote == '"' && c == '\\' && i + 1 < size &&
+               (map[i + 1] == '"' || map[i + 1] == '\\' || map[i + 1] == '\n')){
+        if(map[++i] == '\n'){
+          line++;
+        }else{
+          *out++ = map[i];
+        }
+      }else{
+        if(c == '\n'){
+          line++;
+        }
+        *out++ = c;
+      }
+      continue;
+    }
+
+    if(c == '\\' && i + 1 < size){
+      if(map[++i] == '\n'){
+        line++; // Continuation, acts as a blank between tokens
+        if(in_token){
+          *out++ = '\0';
+          in_token = 0;
+        }
+        continue;
+      }
+      c = map[i];
+      escaped = 1;
+    }else if(c == '\n' || c == '\0' || is_space(c) || (c == '#' && !in_token)){
+      if(in_token){
+        *out++ = '\0';
+        in_token = 0;
+      }
+      if(c == '#'){
+        while(i + 1 < size && map[i + 1] != '\n'){
+          i++;
+        }
+      }else if(c == '\n' || c == '\0'){
+        if(job){
+          if(take_annotations(table, job, filename) < 0 ||
+             push_arg(table, NULL) < 0){ // Null terminate for execvp
+            goto fail;
+          }
+          job = NULL;
+        }
+        line++;
+      }
+      continue;
+    }
+
+    if(!in_token){
+      if(!job){
+        if(grow((void **)&table->jobs, &table->jobs_capacity, table->count + 1, sizeof(struct job)) < 0){
+          goto fail;
+        }
+        job = &table->jobs[table->count++];
+        job->argc = 0;
+        job->line = line;
+        job->nice = 0;
+        job->deadline = 0;
+        job->runtime = 0;
+        job->id = NULL;
+        job->after_names = NULL;
+        job->after = NULL;
+        job->num_after = 0;
+        job->argv = (char **)(long)table->num_args; // Fixed up at the end
+      }
+      if(push_arg(table, out) < 0){
+        goto fail;
+      }
+      job->argc++;
+      in_token = 1;
+    }
+
+    if(!escaped && (c == '\'' || c == '"')){
+      quote = c;
+    }else{
+      *out++ = c;
+    }
+  }
+
+  // argv was kept as an index while args could still be reallocated
+  for(int i = 0; i < table->count; i++){
+    table->jobs[i].argv = table->args + (long)table->jobs[i].argv;
+  }
+  if(resolve_dependencies(table, filename) < 0){
+    goto fail;
+  }
+
+  if(map){
+    munmap((void *)map, size);
+  }
+  return 0;
+
+fail:
+  if(map){
+    munmap((void *)map, size);
+  }
+  free_job_table(table);
+  return -1;
+}
+
+void free_job_table(struct job_table *table){
+  free(table->jobs);
+  free(table->args);
+  free(table->text);
+  free(table->deps);
+  memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,36 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+// One line of the batch file, argv points into the table's arena
+struct job {
+  char **argv;
+  int argc;
+  int line; // Where the job starts in the file, for error messages
+  int nice; // @nice=, -20 to 19, weights the job under the cfs policy
+  long long deadline; // @deadline=, ns after the batch starts, 0 if none
+  long long runtime; // @runtime=, expected CPU time in ns, 0 if unknown
+  const char *id; // @id=, what @after= on later lines calls it, NULL if none
+  char *after_names; // @after= as written, split on its commas until resolved
+  int *after; // The earlier jobs it waits for, as indices into the table
+  int num_after;
+};
+
+// Grows as the file is read, so there is no separate line count up front
+struct job_table {
+  struct job *jobs;
+  int count;
+  int jobs_capacity;
+  char *text; // Unquoted tokens, each NUL-terminated
+  char **args; // Every job's argv back to back, each ended by NULL
+  int num_args;
+  int args_capacity;
+  int *deps; // Every job's after[] back to back
+  int num_deps; // 0 for a flat batch
+};
+
+int load_job_file(const char *filename, struct job_table *table);
+void free_job_table(struct job_table *table);
+long long parse_duration(const char *text);
+long long parse_size(const char *text);
+
+#endif
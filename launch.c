@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "launch.h"
+
+#define STACK_SIZE (16 * 1024) // Per fast child, only needs to reach execve
+
+extern char **environ;
+
+// Sits at the top of a fast child's stack slot, the stack grows down from it
+struct fast_start {
+  struct launcher *launcher;
+  struct job *job;
+  const char *path;
+  int gate; // Read end to wait on
+  int output; // Becomes stdout and stderr, -1 to keep ours
+};
+
+static int fast_child(void *arg){
+  struct fast_start *start = arg;
+  char c;
+
+  // This runs on our memory, fd table and errno until execve, so stick to
+  // raw syscalls. exec gives the job its own copy of the fd table.
+  read(start->gate, &c, 1);
+  if(start->path == NULL){
+    _exit(EXIT_FAILURE);
+  }
+  if(start->output >= 0){
+    // Redirecting in the shared table would redirect the scheduler
+    unshare(CLONE_FILES);
+    dup2(start->output, STDOUT_FILENO);
+    dup2(start->output, STDERR_FILENO);
+  }
+  sigprocmask(SIG_SETMASK, &start->launcher->old_mask, NULL);
+  if(start->launcher->survive){
+    signal(SIGHUP, SIG_IGN);
+  }
+  execve(start->path, start->job->argv, environ);
+  _exit(EXIT_FAILURE);
+}
+
+// execvp's PATH search done up front, the cloned child must not touch errno
+static char *resolve_command(const char *name){
+  if(strchr(name, '/')){
+    return strdup(name);
+  }
+
+  const char *path = getenv("PATH");
+  if(path == NULL){
+    path = "/bin:/usr/bin";
+  }
+
+  size_t name_len = strlen(name);
+  while(1){
+    const char *end = strchrnul(path, ':');
+    size_t dir_len = end - path;
+    char *candidate = (char *)malloc(dir_len + name_len + 3);
+    if(!candidate){
+      return NULL;
+    }
+    if(dir_len == 0){
+      strcpy(candidate, "."); // An empty PATH entry means the current directory
+      dir_len = 1;
+    }else{
+      memcpy(candidate, path, dir_len);
+    }
+    candidate[dir_len] = '/';
+    memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+    if(access(candidate, X_OK) == 0){
+      return candidate;
+    }
+    free(candidate);
+
+    if(*end == '\0'){
+      return NULL;
+    }
+    path = end + 1;
+  }
+}
+
+// FNV-1a of a command name
+static unsigned hash_name(const char *name){
+  uint64_t hash = 14695981039346656037ULL;
+  for(const char *p = name; *p; p++){
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+  return (unsigned)(hash ^ (hash >> 32));
+}
+
+static struct command *find_command(struct command *commands, int slots, const char *name){
+  unsigned i = hash_name(name) & (slots - 1);
+  while(commands[i].name && strcmp(commands[i].name, name) != 0){
+    i = (i + 1) & (slots - 1);
+  }
+  return &commands[i];
+}
+
+// Every distinct argv[0] goes through the PATH search once however the
+// manifest interleaves them
+static const char *lookup_command(struct launcher *launcher, const char *name){
+  if(launcher->command_slots > 0){
+    struct command *command = find_command(launcher->commands, launcher->command_slots, name);
+    if(command->name){
+      return command->path;
+    }
+  }
+
+  if((launcher->num_commands + 1) * 2 > launcher->command_slots){
+    int slots = launcher->command_slots > 0 ? launcher->command_slots * 2 : 64;
+    struct command *commands = (struct command *)calloc(slots, sizeof(struct command));
+    if(!commands){
+      return NULL;
+    }
+    for(int i = 0; i < launcher->command_slots; i++){
+      if(launcher->commands[i].name){
+        *find_command(commands, slots, launcher->commands[i].name) = launcher->commands[i];
+      }
+    }
+    free(launcher->commands);
+    launcher->commands = commands;
+    launcher->command_slots = slots;
+  }
+
+  struct command *command = find_command(launcher->commands, launcher->command_slots, name);
+  command->name = name;
+  command->path = resolve_command(name);
+  if(command->path == NULL){
+    fprintf(stderr, "Execvp failed: %s: %s\n", name, strerror(ENOENT));
+  }
+  launcher->num_commands++;
+  return command->path;
+}
+
+// Blocks SIGUSR1 and SIGCHLD, the caller collects exits through a signalfd
+int launcher_init(struct launcher *launcher, int fast, int count){
+  memset(launcher, 0, sizeof(*launcher));
+  launcher->fast = fast;
+  launcher->barrier[0] = -1;
+  launcher->barrier[1] = -1;
+
+  sigemptyset(&launcher->start_set);
+  sigaddset(&launcher->start_set, SIGUSR1);
+
+  sigset_t block_set = launcher->start_set;
+  sigaddset(&block_set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_set, &launcher->old_mask);
+
+  if(!fast || count == 0){
+    return 0;
+  }
+
+  if(pipe2(launcher->barrier, O_CLOEXEC) < 0){
+    perror("Failed to create start barrier");
+    return -1;
+  }
+
+  launcher->stacks = (char *)mmap(NULL, (size_t)count * STACK_SIZE, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if(launcher->stacks == MAP_FAILED){
+    perror("Failed to allocate launch stacks");
+    launcher->stacks = NULL;
+    return -1;
+  }
+  launcher->slots = count;
+
+  launcher->gates = (int *)malloc(count * sizeof(int));
+  launcher->pending = (int *)malloc(count * sizeof(int));
+  if(!launcher->gates || !launcher->pending){
+    perror("Failed to allocate launch gates");
+    return -1;
+  }
+  for(int i = 0; i < count; i++){
+    launcher->gates[i] = -1;
+  }
+  return 0;
+}
+
+// Returns the child's pid, or -1 with errno set if it could not be created.
+// output, unless -1, is given to the job as its stdout and stderr.
+pid_t launch_job(struct launcher *launcher, struct job *job, int slot, int output){
+  if(!launcher->fast){
+    pid_t pid = fork();
+    if(pid == 0){
+      int sig;
+      sigwait(&launcher->start_set, &sig);
+      sigprocmask(SIG_SETMASK, &launcher->old_mask, NULL);
+      if(launcher->survive){
+        signal(SIGHUP, SIG_IGN);
+      }
+      if(output >= 0){
+        dup2(output, STDOUT_FILENO);
+        dup2(output, STDERR_FILENO);
+      }
+
+      if(execvp(job->argv[0], job->argv) == -1) {
+        perror("Execvp failed");
+        exit(EXIT_FAILURE);
+      }
+    }
+    return pid;
+  }
+
+  if(slot < 0 || slot >= launcher->slots){
+    errno = EINVAL;
+    return -1;
+  }
+
+  char *slot_top = launcher->stacks + (size_t)(slot + 1) * STACK_SIZE;
+  struct fast_start *start = (struct fast_start *)(slot_top - sizeof(struct fast_start));
+  start->launcher = launcher;
+  start->job = job;
+  start->path = lookup_command(launcher, job->argv[0]);
+  start->gate = launcher->barrier[0];
+  start->output = output;
+
+  // The shared barrier is spent once released. Its read end cannot be
+  // closed and reused while a stopped child may still be about to read it,
+  // so later jobs wait on a pipe that lives as long as their slot.
+  if(launcher->released){
+    int gate[2];
+    if(pipe2(gate, O_CLOEXEC) < 0){
+      return -1;
+    }
+    launcher_reclaim(launcher, slot);
+    launcher->gates[slot] = gate[0];
+    launcher->pending[launcher->num_pending++] = gate[1];
+    start->gate = gate[0];
+  }
+
+  char *stack_top = (char *)((unsigned long)start & ~15UL);
+  // Sharing the fd table means no child holds its own copy of the barrier's
+  // write end, so closing ours is enough to release them
+  return clone(fast_child, stack_top, CLONE_VM | CLONE_FILES | SIGCHLD, start);
+}
+
+// Lets every child past its hold and leaves it SIGSTOPped for the scheduler
+void launcher_release(struct launcher *launcher, pid_t *pids, int count){
+  if(!launcher->fast){
+    for(int i = 0; i < count; i++){
+      kill(pids[i], SIGUSR1);
+    }
+    for(int i = 0; i < count; i++){
+      kill(pids[i], SIGSTOP);
+    }
+    return;
+  }
+
+  // Stopped first, so each one only reads EOF and execs once it is dispatched
+  for(int i = 0; i < count; i++){
+    kill(pids[i], SIGSTOP);
+  }
+  if(launcher->barrier[1] >= 0){
+    close(launcher->barrier[1]);
+    launcher->barrier[1] = -1;
+  }
+  launcher->released = 1;
+  for(int i = 0; i < launcher->num_pending; i++){
+    close(launcher->pending[i]);
+  }
+  launcher->num_pending = 0;
+}
+
+// The job in this slot has exec'd or exited, its stack and pipe can be reused
+void launcher_reclaim(struct launcher *launcher, int slot){
+  if(launcher->fast && slot >= 0 && slot < launcher->slots && launcher->gates[slot] >= 0){
+    close(launcher->gates[slot]);
+    launcher->gates[slot] = -1;
+  }
+}
+
+// Only safe once every fast child has exec'd or exited
+void launcher_destroy(struct launcher *launcher){
+  if(launcher->stacks){
+    munmap(launcher->stacks, (size_t)launcher->slots * STACK_SIZE);
+  }
+  for(int i = 0; i < 2; i++){
+    if(launcher->barrier[i] >= 0){
+      close(launcher->barrier[i]);
+    }
+  }
+  for(int i = 0; i < launcher->slots; i++){
+    launcher_reclaim(launcher, i);
+  }
+  for(int i = 0; i < launcher->num_pending; i++){
+    close(launcher->pending[i]);
+  }
+  free(launcher->gates);
+  free(launcher->pending);
+  for(int i = 0; i < launcher->command_slots; i++){
+    free(launcher->commands[i].path);
+  }
+  free(launcher->commands);
+  memset(launcher, 0, sizeof(*launcher));
+}
@@ -0,0 +1,46 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "jobs.h"
+
+// One resolved argv[0], path is NULL if it is not on PATH
+struct command {
+  const char *name; // Points into the job table
+  char *path;
+};
+
+// Starts jobs held before exec, then lets them go all at once. The default
+// forks each job and parks it in sigwait until SIGUSR1. Fast start clones
+// children that share our address space and block on a pipe (the start
+// barrier) until it is closed, so no page tables are copied. Jobs launched
+// after the first release get a pipe of their own, tied to their stack slot
+// until launcher_reclaim(). When we die, our stopped jobs form an orphaned
+// process group, which the kernel sends SIGHUP and SIGCONT. With survive set
+// they ignore the SIGHUP, so a restarted part5 can take them over.
+struct launcher {
+  int fast;
+  sigset_t start_set; // SIGUSR1, what forked children wait for
+  sigset_t old_mask; // Restored in the child before exec
+  int barrier[2];
+  int released; // The shared barrier has been opened
+  char *stacks; // One slot per fast child, live until it execs
+  int slots;
+  int *gates; // Read end of each slot's own pipe, -1 if none
+  int *pending; // Write ends to close at the next release
+  int num_pending;
+  struct command *commands; // Open addressed by name, each resolved once
+  int command_slots; // A power of two, kept at most half full
+  int num_commands;
+  int survive; // Jobs ignore SIGHUP, see below
+};
+
+int launcher_init(struct launcher *launcher, int fast, int count);
+pid_t launch_job(struct launcher *launcher, struct job *job, int slot, int output);
+void launcher_release(struct launcher *launcher, pid_t *pids, int count);
+void launcher_reclaim(struct launcher *launcher, int slot);
+void launcher_destroy(struct launcher *launcher);
+
+#endif
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "output.h"
+#include "sched.h"
+
+#define PIPE_SIZE (256 * 1024) // Room for a chatty job to run a while between drains
+#define SPLICE_CHUNK (1 << 20)
+
+int capturing = 0;
+
+static char output_dir[4096];
+static int log_fd = -1; // --output-log, -1 when each job has its own file
+static long long log_offset;
+static long long total_bytes;
+static int jobs_with_output;
+
+int output_open(const char *dir, const char *log_path){
+  if(log_path){
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(log_fd < 0){
+      fprintf(stderr, "Error: cannot open output log %s: %s\n", log_path, strerror(errno));
+      return -1;
+    }
+    if(write(log_fd, OUTPUT_MAGIC, 8) != 8){
+      perror("Failed to write output log");
+      return -1;
+    }
+    log_offset = 8;
+  }else{
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST){
+      fprintf(stderr, "Error: cannot create output directory %s: %s\n", dir, strerror(errno));
+      return -1;
+    }
+    snprintf(output_dir, sizeof(output_dir), "%s", dir);
+  }
+  capturing = 1;
+  return 0;
+}
+
+// Before launch, so the child is started with the pipe's write end. We keep
+// that end open too: a fast-start child only takes its own copy of our fd
+// table once released, and the exit comes from the pidfd or SIGCHLD anyway.
+int output_attach(struct task *task){
+  int fds[2];
+  if(pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0){
+    perror("Failed to create output pipe");
+    return -1;
+  }
+  fcntl(fds[0], F_SETPIPE_SZ, PIPE_SIZE); // Best effort, past the user's pipe quota it stays small
+  // The job must not see a non-blocking stdout, only our end is
+  fcntl(fds[1], F_SETFL, 0);
+  task->out_fd = fds[0];
+  task->out_write = fds[1];
+
+  if(log_fd < 0){
+    char path[4200];
+    snprintf(path, sizeof(path), "%s/job%d.log", output_dir, task->index + 1);
+    task->out_file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(task->out_file < 0){
+      fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Moves everything in the pipe to the job's file, or to the log as one
+// record per drain. Only we read the pipe, so FIONREAD is exactly what the
+// splice will find.
+void output_drain(struct task *task){
+  if(task->out_fd < 0){
+    return;
+  }
+  if(log_fd < 0){
+    ssize_t n;
+    while((n = splice(task->out_fd, NULL, task->out_file, NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0){
+      task->out_bytes += n;
+      total_bytes += n;
+    }
+    return;
+  }
+
+  int available = 0;
+  if(ioctl(task->out_fd, FIONREAD, &available) < 0 || available == 0){
+    return;
+  }
+  struct output_record record = {now_ns(), task->index, (uint32_t)available};
+  if(pwrite(log_fd, &record, sizeof(record), log_offset) != sizeof(record)){
+    return;
+  }
+  loff_t offset = log_offset + sizeof(record);
+  int left = available;
+  while(left > 0){
+    ssize_t n = splice(task->out_fd, NULL, log_fd, &offset, left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(n <= 0){
+      break;
+    }
+    left -= n;
+  }
+  // A short splice means a full disk, the record says what actually landed
+  if(left > 0){
+    record.length = available - left;
+    pwrite(log_fd, &record, sizeof(record), log_offset);
+  }
+  log_offset = offset;
+  task->out_bytes += available - left;
+  total_bytes += available - left;
+}
+
+// After the job exits, whatever it wrote last is still in the pipe
+void output_release(struct task *task){
+  if(task->out_fd < 0){
+    return;
+  }
+  output_drain(task);
+  jobs_with_output += task->out_bytes > 0;
+  close(task->out_fd);
+  close(task->out_write);
+  task->out_fd = task->out_write = -1;
+  if(task->out_file >= 0){
+    close(task->out_file);
+    task->out_file = -1;
+  }
+}
+
+void output_close(){
+  if(!capturing){
+    return;
+  }
+  printf("Output: %lld bytes from %d jobs captured to %s\n", total_bytes, jobs_with_output,
+    log_fd >= 0 ? "the output log" : output_dir);
+  if(log_fd >= 0){
+    close(log_fd);
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+struct task;
+
+// Per-job output capture. Each job gets a pipe as its stdout and stderr and
+// the event loop splices whatever arrives into the job's own file
+// (--output-dir) or into one log shared by every job (--output-log), so the
+// bytes move from pipe to page cache without passing through our memory.
+// The shared log is a header followed by records, each an output_record and
+// then length bytes of one job's output.
+
+#define OUTPUT_MAGIC "P5OUTPT1"
+
+struct output_record {
+  int64_t ts; // CLOCK_MONOTONIC ns when it was drained
+  int32_t job; // Index of the line in the batch file
+  uint32_t length;
+};
+
+int output_open(const char *dir, const char *log_path);
+int output_attach(struct task *task);
+void output_drain(struct task *task);
+void output_release(struct task *task);
+void output_close();
+
+extern int capturing;
+
+#endif
@@ -5,20 +5,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
-int count_lines(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-      perror("Error opening file");
-      exit(EXIT_FAILURE);
-  }
-  int lines = 0;
-  char line[1024];
-  while (fgets(line, sizeof(line), file) != NULL) {
-      lines++;
-  }
-  fclose(file);
-  return lines;
-}
+#include "jobs.h"
 
 int main(int argc, char *argv[]){
   if(argc != 3){
@@ -31,7 +18,11 @@ int main(int argc, char *argv[]){
     exit(EXIT_FAILURE);
   }
 
-  int num_lines = count_lines(argv[2]);
+  struct job_table table;
+  if(load_job_file(argv[2], &table) < 0){
+    exit(EXIT_FAILURE);
+  }
+  int num_lines = table.count;
 
   pid_t *pid_array = (pid_t*)malloc(num_lines * sizeof(pid_t));
   if (!pid_array) {
@@ -39,48 +30,28 @@ int main(int argc, char *argv[]){
     exit(EXIT_FAILURE);
   }
 
-  FILE *file = fopen(argv[2], "r");
-  if (!file) {
-    perror("Error opening file");
-    free(pid_array);
-    exit(EXIT_FAILURE);
-  }
-
-  int max_args = 10;
-  char line[1024];
   int num_processes = 0;
 
-  while(fgets(line, sizeof(line), file) != NULL){
-    line[strcspn(line, "\n")] = '\0';
-
-    char *args[max_args];
-    char *token = strtok(line, " ");
-    int j = 0;
-
-    while (token != NULL && j < max_args) {
-      args[j++] = token;
-      token = strtok(NULL, " ");
-    }
-    args[j] = NULL; // Null terminate for execvp
+  for(int i = 0; i < table.count; i++){
+    char **args = table.jobs[i].argv;
 
     pid_t pid = fork();
     if(pid < 0){
       perror("Failed to fork process");
-      fclose(file);
       free(pid_array);
+      free_job_table(&table);
       exit(EXIT_FAILURE);
     }else if(pid == 0){
-      fclose(file);
       if(execvp(args[0], args) == -1) {
         perror("Execvp failed");
         free(pid_array);
+        free_job_table(&table);
         exit(EXIT_FAILURE);
       }
     }else{
       pid_array[num_processes++] = pid;
     }
   }
-  fclose(file);
   for (int i = 0; i < num_processes; i++) {
     if (waitpid(pid_array[i], NULL, 0) < 0) {
       perror("Waitpid failed");
@@ -88,6 +59,7 @@ int main(int argc, char *argv[]){
   }
 
   free(pid_array);
+  free_job_table(&table);
 
   return 0;
 }
\ No newline at end of file
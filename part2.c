@@ -6,22 +6,9 @@
 #include <sys/wait.h>
 #include <signal.h>
 
-void signaler(pid_t *pid_array, int size, int signal);
+#include "jobs.h"
 
-int count_lines(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    perror("Error opening file");
-    exit(EXIT_FAILURE);
-  }
-  int lines = 0;
-  char line[1024];
-  while (fgets(line, sizeof(line), file) != NULL) {
-    lines++;
-  }
-  fclose(file);
-  return lines;
-}
+void signaler(pid_t *pid_array, int size, int signal);
 
 int main(int argc, char *argv[]){
   if(argc != 3){
@@ -34,7 +21,11 @@ int main(int argc, char *argv[]){
     exit(EXIT_FAILURE);
   }
 
-  int num_lines = count_lines(argv[2]);
+  struct job_table table;
+  if(load_job_file(argv[2], &table) < 0){
+    exit(EXIT_FAILURE);
+  }
+  int num_lines = table.count;
 
   pid_t *pid_array = (pid_t*)malloc(num_lines * sizeof(pid_t));
   if (!pid_array) {
@@ -42,14 +33,6 @@ int main(int argc, char *argv[]){
     exit(EXIT_FAILURE);
   }
 
-  FILE *file = fopen(argv[2], "r");
-  if (!file) {
-    perror("Error opening file");
-    exit(EXIT_FAILURE);
-  }
-
-  int max_args = 10;
-  char line[1024];
   int num_processes = 0;
 
   sigset_t sigset;
@@ -57,27 +40,16 @@ int main(int argc, char *argv[]){
   sigaddset(&sigset, SIGUSR1);
   sigprocmask(SIG_BLOCK, &sigset, NULL);
 
-  while(fgets(line, sizeof(line), file) != NULL){
-    line[strcspn(line, "\n")] = '\0';
-
-    char *args[max_args];
-    char *token = strtok(line, " ");
-    int j = 0;
-
-    while (token != NULL && j < max_args) {
-      args[j++] = token;
-      token = strtok(NULL, " ");
-    }
-    args[j] = NULL; // Null terminate for execvp
+  for(int i = 0; i < table.count; i++){
+    char **args = table.jobs[i].argv;
 
     pid_t pid = fork();
     if(pid < 0){
       perror("Failed to fork process");
-      fclose(file);
       free(pid_array);
+      free_job_table(&table);
       exit(EXIT_FAILURE);
     }else if(pid == 0){
-      fclose(file);
       int sig;
       printf("Child Process: %d - Waiting for SIGUSR1...\n", getpid());
 
@@ -87,13 +59,13 @@ int main(int argc, char *argv[]){
       if(execvp(args[0], args) == -1) {
         perror("Execvp failed");
         free(pid_array);
+        free_job_table(&table);
         exit(EXIT_FAILURE);
       }
     }else{
       pid_array[num_processes++] = pid;
     }
   }
-  fclose(file);
 
   signaler(pid_array, num_processes, SIGUSR1);
 
@@ -112,6 +84,7 @@ int main(int argc, char *argv[]){
   }
 
   free(pid_array);
+  free_job_table(&table);
 
   return 0;
 }
@@ -2,36 +2,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <stdatomic.h>
+
+#include "jobs.h"
 
 #define TIME_SLICE 1 // Time quantum for the RR (Round Robin) algorithm
+#define EVENT_RING 256 // A power of two so indexes just mask
+
+#if ATOMIC_INT_LOCK_FREE != 2
+#error "the event ring needs lock-free atomics to be safe in a signal handler"
+#endif
+
+// The signal handlers only record what happened. Both block each other while
+// they run, so they are a single producer and the main loop the single
+// consumer, and neither side ever waits on the other.
+enum event_type {
+  EVENT_TIMER,
+  EVENT_EXIT,
+};
+
+struct event {
+  int type;
+  pid_t pid; // EVENT_EXIT only
+  int status;
+};
 
 void alarm_handler(int sig);
+void child_handler(int sig);
+int push_event(int type, pid_t pid, int status);
+void reap_children();
+void run_event_loop();
+void schedule_next(int preempt);
 void signaler(pid_t *pid_array, int size, int signal);
 
-// Moved these outside of main so alarm_handler can access them
+// Shared with the handlers only through the event ring
+struct event events[EVENT_RING];
+_Atomic unsigned event_head; // Next slot the handlers fill
+_Atomic unsigned event_tail; // Next slot the main loop drains
+volatile sig_atomic_t timer_pending; // A timer event is queued, more would say nothing new
+volatile sig_atomic_t reap_pending; // The ring filled up, waitpid() again once drained
+
+// Only the main loop touches these
 pid_t *pid_array;
 int *process_completed; // Array to track completed processes
 int num_processes = 0;
 int current_process = 0;
 int finished_processes = 0;
-
-int count_lines(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    perror("Error opening file");
-    exit(EXIT_FAILURE);
-  }
-  int lines = 0;
-  char line[1024];
-  while (fgets(line, sizeof(line), file) != NULL) {
-    lines++;
-  }
-  fclose(file);
-  return lines;
-}
+struct job_table table;
 
 int main(int argc, char *argv[]){
   if(argc != 3){
@@ -44,7 +65,10 @@ int main(int argc, char *argv[]){
     exit(EXIT_FAILURE);
   }
 
-  int num_lines = count_lines(argv[2]);
+  if(load_job_file(argv[2], &table) < 0){
+    exit(EXIT_FAILURE);
+  }
+  int num_lines = table.count;
 
   pid_array = (pid_t*)malloc(num_lines * sizeof(pid_t));
   process_completed = (int*)malloc(num_lines * sizeof(int));
@@ -58,45 +82,22 @@ int main(int argc, char *argv[]){
     process_completed[i] = 0;
   }
 
-  FILE *file = fopen(argv[2], "r");
-  if (!file) {
-    perror("Error opening file");
-    free(pid_array);
-    free(process_completed);
-    exit(EXIT_FAILURE);
-  }
-
-  int max_args = 10;
-  char line[1024];
-
   sigset_t sigset;
   sigemptyset(&sigset);
   sigaddset(&sigset, SIGUSR1);
   sigprocmask(SIG_BLOCK, &sigset, NULL);
-  signal(SIGALRM, alarm_handler);
-
-  while(fgets(line, sizeof(line), file) != NULL){
-    line[strcspn(line, "\n")] = '\0';
 
-    char *args[max_args];
-    char *token = strtok(line, " ");
-    int j = 0;
-
-    while (token != NULL && j < max_args) {
-      args[j++] = token;
-      token = strtok(NULL, " ");
-    }
-    args[j] = NULL; // Null terminate for execvp
+  for(int i = 0; i < table.count; i++){
+    char **args = table.jobs[i].argv;
 
     pid_t pid = fork();
     if(pid < 0){
       perror("Failed to fork process");
-      fclose(file);
       free(pid_array);
+      free_job_table(&table);
       free(process_completed);
       exit(EXIT_FAILURE);
     }else if(pid == 0){
-      fclose(file);
       int sig;
       // printf("Child Process: %d - Waiting for SIGUSR1...\n", getpid());
       sigwait(&sigset, &sig);
@@ -105,6 +106,7 @@ int main(int argc, char *argv[]){
       if(execvp(args[0], args) == -1) {
         perror("Execvp failed");
         free(pid_array);
+        free_job_table(&table);
         free(process_completed);
         exit(EXIT_FAILURE);
       }
@@ -112,7 +114,19 @@ int main(int argc, char *argv[]){
       pid_array[num_processes++] = pid;
     }
   }
-  fclose(file);
+
+  // Installed after the forks so the jobs start with default handlers and
+  // an unblocked mask. Stops are our own doing and not worth an event.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sigaddset(&sa.sa_mask, SIGALRM);
+  sigaddset(&sa.sa_mask, SIGCHLD);
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sa.sa_handler = alarm_handler;
+  sigaction(SIGALRM, &sa, NULL);
+  sa.sa_handler = child_handler;
+  sigaction(SIGCHLD, &sa, NULL);
 
   signaler(pid_array, num_processes, SIGUSR1);
   signaler(pid_array, num_processes, SIGSTOP);
@@ -123,52 +137,131 @@ int main(int argc, char *argv[]){
     alarm(TIME_SLICE);
   }
 
-  for(int i = 0; i < num_processes; i++){
-    if(!process_completed[i]){
-      if(waitpid(pid_array[i], NULL, 0) < 0){
-        perror("Waitpid failed");
-      }else{
-        process_completed[i] = 1;
-      }
-    }
-  }
+  run_event_loop();
+  printf("All child processes have completed.\n");
 
   free(pid_array);
+  free_job_table(&table);
   free(process_completed);
 
   return 0;
 }
 
-void alarm_handler(int sig){ // Round Robin implementation
+void alarm_handler(int sig){
+  if(!timer_pending){
+    timer_pending = push_event(EVENT_TIMER, 0, 0) == 0;
+  }
+}
+
+void child_handler(int sig){
+  int saved = errno;
+  reap_children();
+  errno = saved;
+}
+
+// Takes every exited child off the kernel's hands while there is room to
+// record it, a full ring leaves the rest for the main loop to collect. The
+// last slot is the timer's, the alarm is one-shot and is only rearmed once
+// its event has been seen.
+void reap_children(){
   int status;
-  if(waitpid(pid_array[current_process], &status, WNOHANG) > 0){
+  pid_t pid;
+  while(atomic_load_explicit(&event_head, memory_order_relaxed) -
+        atomic_load_explicit(&event_tail, memory_order_acquire) < EVENT_RING - 1){
+    pid = waitpid(-1, &status, WNOHANG);
+    if(pid <= 0){
+      return;
+    }
     if(WIFEXITED(status) || WIFSIGNALED(status)){
-      finished_processes++;
-      process_completed[current_process] = 1;
-      if (finished_processes == num_processes) {
-        printf("All child processes have completed.\n");
-        free(pid_array);
-        free(process_completed);
-        exit(0);
-      }
+      push_event(EVENT_EXIT, pid, status);
     }
-  }else{
-    kill(pid_array[current_process], SIGSTOP);
   }
+  reap_pending = 1;
+}
+
+// Only ever runs with SIGALRM and SIGCHLD blocked, in a handler or the main
+// loop, so there is never more than one producer. Returns -1 when the ring
+// is full.
+int push_event(int type, pid_t pid, int status){
+  unsigned head = atomic_load_explicit(&event_head, memory_order_relaxed);
+  if(head - atomic_load_explicit(&event_tail, memory_order_acquire) >= EVENT_RING){
+    return -1;
+  }
+  struct event *event = &events[head & (EVENT_RING - 1)];
+  event->type = type;
+  event->pid = pid;
+  event->status = status;
+  atomic_store_explicit(&event_head, head + 1, memory_order_release);
+  return 0;
+}
 
-  current_process = (current_process + 1) % num_processes;
+void run_event_loop(){
+  sigset_t handled, wait_mask;
+  sigemptyset(&handled);
+  sigaddset(&handled, SIGALRM);
+  sigaddset(&handled, SIGCHLD);
 
-  int start = current_process;
   while(finished_processes < num_processes){
-    if(waitpid(pid_array[current_process], &status, WNOHANG) == 0){
-      printf("Scheduling Process %d\n", pid_array[current_process]);
-      kill(pid_array[current_process], SIGCONT);
-      alarm(TIME_SLICE);
+    unsigned tail = atomic_load_explicit(&event_tail, memory_order_relaxed);
+    if(tail == atomic_load_explicit(&event_head, memory_order_acquire)){
+      // Blocked across the check and the sleep so no signal lands in between,
+      // and so reaping from here never races a handler as a second producer
+      sigprocmask(SIG_BLOCK, &handled, &wait_mask);
+      if(reap_pending){
+        reap_pending = 0;
+        reap_children();
+      }else if(tail == atomic_load_explicit(&event_head, memory_order_acquire)){
+        sigsuspend(&wait_mask);
+      }
+      sigprocmask(SIG_SETMASK, &wait_mask, NULL);
+      continue;
+    }
+
+    // A burst of exits is handled in one pass, the switch waits until the
+    // whole burst is accounted for
+    int expired = 0;
+    int exited = 0;
+    unsigned head = atomic_load_explicit(&event_head, memory_order_acquire);
+    for(; tail != head; tail++){
+      struct event *event = &events[tail & (EVENT_RING - 1)];
+      if(event->type == EVENT_TIMER){
+        timer_pending = 0;
+        expired = 1;
+        continue;
+      }
+      for(int i = 0; i < num_processes; i++){
+        if(pid_array[i] == event->pid && !process_completed[i]){
+          process_completed[i] = 1;
+          finished_processes++;
+          exited |= i == current_process;
+        }
+      }
+    }
+    atomic_store_explicit(&event_tail, tail, memory_order_release);
+
+    if((expired || exited) && finished_processes < num_processes){
+      schedule_next(!exited);
+    }
+  }
+}
+
+// Round Robin: on to the next job still alive, stopping the current one
+// first if its slice ran out
+void schedule_next(int preempt){
+  if(preempt && !process_completed[current_process]){
+    kill(pid_array[current_process], SIGSTOP);
+  }
+
+  for(int i = 1; i <= num_processes; i++){
+    int next = (current_process + i) % num_processes;
+    if(!process_completed[next]){
+      current_process = next;
       break;
     }
-    current_process = (current_process + 1) % num_processes;
-    if(current_process == start)break;
   }
+  printf("Scheduling Process %d\n", pid_array[current_process]);
+  kill(pid_array[current_process], SIGCONT);
+  alarm(TIME_SLICE);
 }
 
 void signaler(pid_t *pid_array, int size, int signal){
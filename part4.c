@@ -2,139 +2,340 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <signal.h>
 
-#define TIME_SLICE 1 // Time quantum for the RR (Round Robin) algorithm
-#define MAX_ARGS 10
+#include "jobs.h"
 
-void alarm_handler(int sig);
+#define TIME_SLICE 1000000000LL // Default time quantum in ns for the RR (Round Robin) algorithm
+#define MIN_TIME_SLICE 500000LL // Minimum allowed time quantum (500 us)
+#define DISPLAY_INTERVAL 2000000000LL // How often the process table is printed
+#define MAX_EVENTS 64
+
+// epoll tags for the scheduler's own fds, pidfds are tagged with their index
+#define TIMER_TAG -1
+#define SIGNAL_TAG -2
+
+void schedule_next();
 void signaler(pid_t *pid_array, int size, int signal);
 void display_process_info();
-
-// Moved these outside of main so alarm_handler can access them
+void setup_event_loop();
+void run_event_loop();
+void reap_children();
+void reap_job(int index);
+void finish_job(int index);
+void dispatch(int index);
+long long now_ns();
+
+// Moved these outside of main so the event loop can access them
 pid_t *pid_array;
 int *process_completed; // Array to track completed processes
+int *pidfds; // Exit notification per child, -1 if pidfd_open is unavailable
+int *next_live; // Circular list of the jobs that have not exited, by index
+int *prev_live;
 int num_processes = 0;
-int current_process = 0;
+int current_process = -1; // Running job, or where the next pick starts when idle
+int running = 0;
+int missing_pidfds = 0; // Children only SIGCHLD can tell us about
 int finished_processes = 0;
-int display_counter = 0; // For displaying the process info every full cycle
+long long time_slice = TIME_SLICE; // Quantum, set with -q
+long long last_display = 0; // For displaying the process info every DISPLAY_INTERVAL
 
-int count_lines(const char *filename){
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    perror("Error opening file");
-    exit(EXIT_FAILURE);
-  }
-  int lines = 0;
-  char line[1024];
-  while (fgets(line, sizeof(line), file) != NULL) {
-    lines++;
-  }
-  fclose(file);
-  return lines;
-}
+int epoll_fd = -1;
+int timer_fd = -1;
+int signal_fd = -1;
+
+long long slice_deadline = 0; // When the running quantum is due to expire
+long long switch_count = 0;
+long long total_latency = 0;
+long long max_latency = 0;
 
 int main(int argc, char *argv[]){
-  if(argc != 3){
+  const char *filename = NULL;
+  int opt;
+
+  while((opt = getopt(argc, argv, "f:q:")) != -1){
+    switch(opt){
+      case 'f':
+        filename = optarg;
+        break;
+      case 'q':
+        time_slice = parse_duration(optarg);
+        if(time_slice < MIN_TIME_SLICE){
+          fprintf(stderr, "Error: invalid time quantum '%s' (minimum 500us)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        fprintf(stderr, "Usage: %s -f <file> [-q quantum]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind != argc){
     fprintf(stderr, "Invalid use: incorrect number of parameters\n");
     exit(EXIT_FAILURE);
   }
 
-  if (strcmp(argv[1], "-f") != 0) {
+  if (filename == NULL) {
     fprintf(stderr, "Error: Missing '-f' flag\n");
     exit(EXIT_FAILURE);
   }
 
-  int lines = count_lines(argv[2]);
+  struct job_table table;
+  if(load_job_file(filename, &table) < 0){
+    exit(EXIT_FAILURE);
+  }
+  int lines = table.count;
 
   pid_array = (pid_t*)malloc(lines * sizeof(pid_t));
   process_completed = (int*)malloc(lines * sizeof(int));
-  if (!pid_array || !process_completed) {
+  pidfds = (int*)malloc(lines * sizeof(int));
+  next_live = (int*)malloc(lines * sizeof(int));
+  prev_live = (int*)malloc(lines * sizeof(int));
+  if (!pid_array || !process_completed || !pidfds || !next_live || !prev_live) {
     perror("Failed to allocate memory for process arrays");
     exit(EXIT_FAILURE);
   }
 
   for (int i = 0; i < lines; i++) {
     process_completed[i] = 0;
+    pidfds[i] = -1;
   }
 
-  FILE *file = fopen(argv[2], "r");
-  if (!file) {
-    perror("Error opening file");
-    free(pid_array);
-    free(process_completed);
-    exit(EXIT_FAILURE);
-  }
-
-  char line[1024];
-
-  sigset_t sigset;
+  // SIGCHLD is blocked before the first fork so no exit can slip past the signalfd
+  sigset_t sigset, old_mask;
   sigemptyset(&sigset);
   sigaddset(&sigset, SIGUSR1);
-  sigprocmask(SIG_BLOCK, &sigset, NULL);
-  signal(SIGALRM, alarm_handler);
+  sigaddset(&sigset, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &sigset, &old_mask);
 
-  while(fgets(line, sizeof(line), file) != NULL){
-    line[strcspn(line, "\n")] = '\0';
+  sigset_t start_set;
+  sigemptyset(&start_set);
+  sigaddset(&start_set, SIGUSR1);
 
-    char *args[MAX_ARGS];
-    char *token = strtok(line, " ");
-    int j = 0;
-
-    while (token != NULL && j < MAX_ARGS) {
-      args[j++] = token;
-      token = strtok(NULL, " ");
-    }
-    args[j] = NULL; // Null terminate for execvp
+  for(int i = 0; i < table.count; i++){
+    char **args = table.jobs[i].argv;
 
     pid_t pid = fork();
     if(pid < 0){
       perror("Failed to fork process");
-      fclose(file);
       free(pid_array);
+      free_job_table(&table);
       free(process_completed);
+      free(pidfds);
       exit(EXIT_FAILURE);
     }else if(pid == 0){
-      fclose(file);
       int sig;
-      sigwait(&sigset, &sig);
+      sigwait(&start_set, &sig);
+      sigprocmask(SIG_SETMASK, &old_mask, NULL);
 
       if(execvp(args[0], args) == -1) {
         perror("Execvp failed");
         free(pid_array);
+        free_job_table(&table);
         free(process_completed);
+        free(pidfds);
         exit(EXIT_FAILURE);
       }
     }else{
+      pidfds[num_processes] = syscall(SYS_pidfd_open, pid, 0);
+      if(pidfds[num_processes] < 0){
+        missing_pidfds++;
+      }
       pid_array[num_processes++] = pid;
     }
   }
-  fclose(file);
 
   signaler(pid_array, num_processes, SIGUSR1);
   signaler(pid_array, num_processes, SIGSTOP);
 
-  if (num_processes > 0) {
+  for(int i = 0; i < num_processes; i++){
+    next_live[i] = (i + 1) % num_processes;
+    prev_live[i] = (i + num_processes - 1) % num_processes;
+  }
+  current_process = num_processes - 1; // So the first pick is job 0
+
+  setup_event_loop();
+  reap_children(); // Children that failed to exec may already be gone
+
+  if (finished_processes < num_processes) {
+    current_process = next_live[current_process];
+    running = 1;
     printf("Scheduling Process %d\n", pid_array[current_process]);
-    kill(pid_array[current_process], SIGCONT);
-    alarm(TIME_SLICE);
+    last_display = now_ns();
+    dispatch(current_process);
+    run_event_loop();
+  }
+
+  printf("All child processes have completed.\n");
+  if(switch_count > 0){
+    printf("Dispatch latency: avg %lld us, max %lld us over %lld switches\n",
+      total_latency / switch_count / 1000, max_latency / 1000, switch_count);
   }
 
+  close(epoll_fd);
+  close(timer_fd);
+  close(signal_fd);
+  free(pid_array);
+  free_job_table(&table);
+  free(process_completed);
+  free(pidfds);
+  free(next_live);
+  free(prev_live);
+  return 0;
+}
+
+long long now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void setup_event_loop(){
+  struct epoll_event ev;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(epoll_fd < 0 || timer_fd < 0){
+    perror("Failed to create scheduler event loop");
+    exit(EXIT_FAILURE);
+  }
+
+  // Stopping a child on every quantum would otherwise raise SIGCHLD too
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_DFL;
+  sa.sa_flags = SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  sigset_t chld_set;
+  sigemptyset(&chld_set);
+  sigaddset(&chld_set, SIGCHLD);
+  signal_fd = signalfd(-1, &chld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+  if(signal_fd < 0){
+    perror("Failed to create signalfd");
+    exit(EXIT_FAILURE);
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.u64 = (uint64_t)TIMER_TAG;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+  ev.data.u64 = (uint64_t)SIGNAL_TAG;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
   for(int i = 0; i < num_processes; i++){
-    if(!process_completed[i]){
-      if(waitpid(pid_array[i], NULL, 0) < 0){
-        perror("Waitpid failed");
+    if(pidfds[i] >= 0){
+      ev.data.u64 = (uint64_t)i;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[i], &ev);
+    }
+  }
+}
+
+void run_event_loop(){
+  struct epoll_event events[MAX_EVENTS];
+
+  while(finished_processes < num_processes){
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      perror("epoll_wait failed");
+      exit(EXIT_FAILURE);
+    }
+
+    int expired = 0;
+    int signaled = 0;
+    for(int i = 0; i < n; i++){
+      int tag = (int)events[i].data.u64;
+      if(tag == TIMER_TAG){
+        uint64_t expirations;
+        // Re-arming the timer clears expirations that were already reported
+        if(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+          expired = 1;
+        }
+      }else if(tag == SIGNAL_TAG){
+        struct signalfd_siginfo info;
+        while(read(signal_fd, &info, sizeof(info)) == sizeof(info));
+        signaled = 1;
       }else{
-        process_completed[i] = 1;
+        reap_job(tag); // The pidfd says which job, no need to search
       }
     }
+
+    if(signaled && missing_pidfds > 0){
+      reap_children();
+    }
+    // Switch on quantum expiry, or straight away if the running job exited
+    if(finished_processes < num_processes && (expired || !running)){
+      schedule_next();
+    }
   }
+}
 
-  free(pid_array);
-  free(process_completed);
-  return 0;
+// Fallback for children without a pidfd, which have to be looked up by pid
+void reap_children(){
+  int status;
+  pid_t pid;
+  while((pid = waitpid(-1, &status, WNOHANG)) > 0){
+    if(!WIFEXITED(status) && !WIFSIGNALED(status)){
+      continue;
+    }
+    for(int i = 0; i < num_processes; i++){
+      if(pid_array[i] == pid && !process_completed[i]){
+        finish_job(i);
+        break;
+      }
+    }
+  }
+}
+
+void reap_job(int index){
+  int status;
+  if(!process_completed[index] && waitpid(pid_array[index], &status, WNOHANG) == pid_array[index]){
+    finish_job(index);
+  }
+}
+
+// Unlinks the job from the live list. If it was the current job the cursor
+// steps back to its predecessor, so the next pick is the job that followed it.
+void finish_job(int index){
+  process_completed[index] = 1;
+  finished_processes++;
+  if(pidfds[index] >= 0){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfds[index], NULL);
+    close(pidfds[index]);
+    pidfds[index] = -1;
+  }else{
+    missing_pidfds--;
+  }
+
+  next_live[prev_live[index]] = next_live[index];
+  prev_live[next_live[index]] = prev_live[index];
+  if(index == current_process){
+    current_process = finished_processes < num_processes ? prev_live[index] : -1;
+    running = 0;
+  }
+}
+
+void dispatch(int index){
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = time_slice / 1000000000LL;
+  its.it_value.tv_nsec = time_slice % 1000000000LL;
+
+  kill(pid_array[index], SIGCONT);
+  timerfd_settime(timer_fd, 0, &its, NULL);
+  slice_deadline = now_ns() + time_slice;
 }
 
 void display_process_info(){
@@ -177,42 +378,31 @@ void display_process_info(){
   }
 }
 
-
-
-void alarm_handler(int sig){ // Round Robin implementation
-  int status;
-  if(waitpid(pid_array[current_process], &status, WNOHANG) > 0){
-    if(WIFEXITED(status) || WIFSIGNALED(status)){
-      finished_processes++;
-      process_completed[current_process] = 1;
-      if (finished_processes == num_processes) {
-        printf("All child processes have completed.\n");
-        free(pid_array);
-        free(process_completed);
-        exit(0);
-      }
-    }
-  }else{
+void schedule_next(){ // Round Robin implementation
+  int expired = running;
+  if(expired){
     kill(pid_array[current_process], SIGSTOP);
   }
 
-  display_counter++;
-  if(display_counter % 2 == 0){
+  long long now = now_ns();
+  if(now - last_display >= DISPLAY_INTERVAL){
+    last_display = now;
     display_process_info();
   }
 
-  current_process = (current_process + 1) % num_processes;
-
-  int start = current_process;
-  while(finished_processes < num_processes){
-    if(waitpid(pid_array[current_process], &status, WNOHANG) == 0){
-      //printf("Scheduling Process %d\n", pid_array[current_process]);
-      kill(pid_array[current_process], SIGCONT);
-      alarm(TIME_SLICE);
-      break;
+  if(current_process >= 0){
+    current_process = next_live[current_process];
+    running = 1;
+    //printf("Scheduling Process %d\n", pid_array[current_process]);
+    if(expired){
+      long long latency = now_ns() - slice_deadline;
+      switch_count++;
+      total_latency += latency;
+      if(latency > max_latency){
+        max_latency = latency;
+      }
     }
-    current_process = (current_process + 1) % num_processes;
-    if(current_process == start)break;
+    dispatch(current_process);
   }
 }
 
@@ -221,4 +411,4 @@ void signaler(pid_t *pid_array, int size, int signal){
     // printf("Parent process: Sending signal %d to child process %d\n", signal, pid_array[i]);
     kill(pid_array[i], signal);
   }
-}
\ No newline at end of file
+}
@@ -1,256 +1,1308 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <signal.h>
+#include <sched.h>
+#include <limits.h>
 
-#define TIME_SLICE 1 // Time quantum for the RR (Round Robin) algorithm
-#define MIN_TIME_SLICE 1 // Minimum allowed time quantum
-#define MAX_ARGS 10
+#include "jobs.h"
+#include "launch.h"
+#include "procstat.h"
+#include "sched.h"
+#include "control.h"
+#include "trace.h"
+#include "stats.h"
+#include "report.h"
+#include "checkpoint.h"
+#include "graph.h"
+#include "output.h"
 
-void alarm_handler(int sig);
-void signaler(pid_t *pid_array, int size, int signal);
+#define REPORT_INTERVAL 2000000000LL // Default for how often the process table is printed
+#define MAX_EVENTS 64
+#define PRESSURE_INTERVAL 100000000LL // PSI only moves every couple of seconds anyway
+#define MAX_DEFERRED 8 // Candidates tried per switch before a core is left idle
+#define BLOCK_CHECK 10000000LL // Default for how often running jobs are checked for sleeping
+
+// epoll tags for the scheduler's own fds, pidfds are tagged with their index
+// and output pipes with their index after all of those
+#define OUTPUT_TAG(index) (total_jobs + (index))
+#define SIGNAL_TAG -1
+#define REPORT_TAG -2
+#define BLOCK_TAG -3
+#define TIMER_TAG(core) (-4 - (core))
+
+// One of the -j slots, each with its own quantum timer and run queue
+struct core {
+  int cpu; // CPU its tasks are pinned to
+  int timer_fd;
+  struct task *current; // The task holding this CPU, NULL when idle
+  long long slice_deadline; // When the running quantum is due to expire
+  int expired;
+};
+
+void setup_cores();
+void schedule_next(struct core *core);
 void display_process_info();
-void adjust_time_slice(int index);
+void sample_task(struct task *task, struct tick *tick);
+void setup_event_loop();
+void run_event_loop();
+void reap_children();
+void dispatch(struct core *core, struct task *task, long long latency);
+void raise_fd_limit();
+void write_results(const char *path);
+void report_deadlines();
+void admit_task(int index, int slot);
+void admit_waiting();
+void finish_task(struct task *task, int status);
+void resume_tasks();
+int adopt_task(struct task *task, struct checkpoint_record *record);
+void watch_task(struct task *task);
+int fits_in_memory(struct core *core, struct task *task);
+void report_memory();
+void check_blocked();
+void push_ready(struct task *task);
+void release_dependents(struct task *task, int push);
+void skip_dependents(struct task *task);
+void preempt_blocked(struct core *core);
 
-pid_t *pid_array;
-int *process_completed;
-int *time_slices; // Array for the dynamic time slices
-int num_processes = 0;
-int current_process = 0;
+struct task *tasks;
+struct core *cores;
+struct policy *policy = &rr_policy;
+struct control *control = &signal_control;
+struct stats_source *stats = NULL; // -S, the first of stats_sources that opens by default
+int total_jobs = 0; // Lines in the batch file
 int finished_processes = 0;
-int display_counter = 0;
+long clock_ticks_per_sec;
+long long report_interval = REPORT_INTERVAL; // --report-interval, 0 turns the table off
+int report_fd = -1;
+long long run_start = 0; // Just before the first launch
+long long run_end = 0; // When the last job was reaped
 
-int count_lines(const char *filename){
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    perror("Error opening file");
-    exit(EXIT_FAILURE);
-  }
-  int lines = 0;
-  char line[1024];
-  while (fgets(line, sizeof(line), file) != NULL) {
-    lines++;
-  }
-  fclose(file);
-  return lines;
-}
+struct job_table table;
+struct launcher launcher;
+int *free_slots; // Launcher slots whose job has exited, see --max-live
+int num_free_slots = 0;
+struct task_heap ready; // Jobs with nothing left to wait for, not launched yet
+int *skip_stack; // Worklist for skip_dependents()
+long long skipped = 0; // Never run because a job they wait for failed
+pid_t *pids; // Batch handed to launcher_release
+struct task **admitted; // Tasks behind pids
+struct task **live; // Tasks sampled together for the process table
+struct task_stats *live_stats;
+
+int epoll_fd = -1;
+int signal_fd = -1;
+
+long long switch_count = 0;
+long long total_latency = 0;
+long long max_latency = 0;
+long long control_time = 0; // Spent in control->stop() and resume()
+long long control_count = 0;
+
+long long memory_budget = 0; // -m, bytes of RSS the running jobs may hold together
+double psi_limit = 0; // --psi-limit, some avg10 percentage above which one job runs at a time
+int pressure_fd = -1;
+double memory_pressure = 0;
+long long last_pressure_read = 0;
+long page_size;
+long long deferrals = 0; // Picks put back because they would not fit
+long long max_running_rss = 0;
+
+long long block_check = BLOCK_CHECK; // --block-check, 0 lets a job keep a slice it sleeps through
+int block_fd = -1;
+struct task_queue blocked; // Taken off a core asleep, left running so they can wake
+struct task_queue woken; // Stopped again once awake, dispatched ahead of the policy's pick
+long long early_preemptions = 0;
 
 int main(int argc, char *argv[]){
-  if(argc != 3){
+  const char *filename = NULL;
+  const char *cgroup_root = NULL;
+  const char *results = NULL;
+  const char *trace_path = NULL;
+  const char *stats_name = NULL;
+  const char *state_path = NULL;
+  const char *history_path = NULL;
+  const char *output_dir = NULL;
+  const char *output_log = NULL;
+  int report_format = REPORT_TABLE;
+  int cpu_share = 0;
+  int fast_start = 0;
+  int max_live = 0;
+  int opt;
+
+  static struct option long_options[] = {
+    {"max-live", required_argument, NULL, 'w'},
+    {"psi-limit", required_argument, NULL, 'M'},
+    {"report-format", required_argument, NULL, 'o'},
+    {"report-interval", required_argument, NULL, 'i'},
+    {"state", required_argument, NULL, 'c'},
+    {"block-check", required_argument, NULL, 'k'},
+    {"history", required_argument, NULL, 'H'},
+    {"output-dir", required_argument, NULL, 'O'},
+    {"output-log", required_argument, NULL, 'L'},
+    {NULL, 0, NULL, 0}
+  };
+
+  while((opt = getopt_long(argc, argv, "f:q:Fp:l:b:j:g:s:r:t:w:m:M:S:o:i:c:k:H:O:L:", long_options, NULL)) != -1){
+    switch(opt){
+      case 'f':
+        filename = optarg;
+        break;
+      case 'q':
+        config.quantum = parse_duration(optarg);
+        if(config.quantum < MIN_TIME_SLICE){
+          fprintf(stderr, "Error: invalid time quantum '%s' (minimum 500us)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'F':
+        fast_start = 1;
+        break;
+      case 'p':
+        policy = NULL;
+        for(int i = 0; policies[i]; i++){
+          if(strcmp(optarg, policies[i]->name) == 0){
+            policy = policies[i];
+          }
+        }
+        if(policy == NULL){
+          fprintf(stderr, "Error: unknown policy '%s' (rr, mlfq, cfs, edf or cpath)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'l':
+        config.levels = atoi(optarg);
+        break;
+      case 'b':
+        config.boost_interval = parse_duration(optarg);
+        if(config.boost_interval <= 0){
+          fprintf(stderr, "Error: invalid boost interval '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'j':
+        config.cores = atoi(optarg);
+        if(config.cores < 1){
+          fprintf(stderr, "Error: invalid number of cores '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'g':
+        cgroup_root = optarg;
+        control = &cgroup_control;
+        break;
+      case 's':
+        cpu_share = atoi(optarg);
+        if(cpu_share < 1 || cpu_share > 100){
+          fprintf(stderr, "Error: invalid CPU share '%s' (1 to 100 percent)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'r':
+        results = optarg;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'w':
+        max_live = atoi(optarg);
+        if(max_live < 1){
+          fprintf(stderr, "Error: invalid --max-live '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'm':
+        memory_budget = parse_size(optarg);
+        if(memory_budget <= 0){
+          fprintf(stderr, "Error: invalid memory budget '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'M':
+        psi_limit = atof(optarg);
+        if(psi_limit <= 0 || psi_limit > 100){
+          fprintf(stderr, "Error: invalid --psi-limit '%s' (0 to 100 percent)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'S':
+        stats_name = optarg;
+        break;
+      case 'c':
+        state_path = optarg;
+        break;
+      case 'H':
+        history_path = optarg;
+        break;
+      case 'O':
+        output_dir = optarg;
+        break;
+      case 'L':
+        output_log = optarg;
+        break;
+      case 'o':
+        report_format = parse_report_format(optarg);
+        if(report_format < 0){
+          fprintf(stderr, "Error: unknown report format '%s' (table, csv or json)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'i':
+        report_interval = strcmp(optarg, "0") == 0 ? 0 : parse_duration(optarg);
+        if(report_interval < 0 || (report_interval > 0 && report_interval < MIN_TIME_SLICE)){
+          fprintf(stderr, "Error: invalid report interval '%s' (0 or at least 500us)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'k':
+        block_check = strcmp(optarg, "0") == 0 ? 0 : parse_duration(optarg);
+        if(block_check < 0 || (block_check > 0 && block_check < MIN_TIME_SLICE)){
+          fprintf(stderr, "Error: invalid block check interval '%s' (0 or at least 500us)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        fprintf(stderr, "Usage: %s -f <file> [-q quantum] [-F] [-p rr|mlfq|cfs|edf|cpath] [-l levels] [-b boost] [-j cores] [-g cgroup dir [-s share%%]] [-r results] [-t trace] [--max-live N] [-m budget] [--psi-limit pct] [-S taskstats|proc|cgroup|perf] [--report-format table|csv|json] [--report-interval t] [--state file] [--block-check t] [--history file] [--output-dir dir | --output-log file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind != argc){
     fprintf(stderr, "Invalid use: incorrect number of parameters\n");
     exit(EXIT_FAILURE);
   }
 
-  if (strcmp(argv[1], "-f") != 0) {
+  if (filename == NULL) {
     fprintf(stderr, "Error: Missing '-f' flag\n");
     exit(EXIT_FAILURE);
   }
 
-  int lines = count_lines(argv[2]);
+  if(output_dir && output_log){
+    fprintf(stderr, "Error: '--output-dir' and '--output-log' cannot be used together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(cpu_share > 0 && cgroup_root == NULL){
+    fprintf(stderr, "Error: '-s' needs a cgroup directory from '-g'\n");
+    exit(EXIT_FAILURE);
+  }
+
+  clock_ticks_per_sec = sysconf(_SC_CLK_TCK);
+  config.tick_ns = 1000000000LL / clock_ticks_per_sec;
+  page_size = sysconf(_SC_PAGESIZE);
+
+  stats_want_io = policy->needs_io;
+  for(int i = 0; stats_sources[i] && stats == NULL; i++){
+    struct stats_source *source = stats_sources[i];
+    if(stats_name ? strcmp(stats_name, source->name) == 0 : source != &cgroup_stats){
+      if(source == &cgroup_stats && cgroup_root == NULL){
+        fprintf(stderr, "Error: '-S cgroup' needs a cgroup directory from '-g'\n");
+        exit(EXIT_FAILURE);
+      }
+      if(source->open() == 0){
+        stats = source;
+      }else if(stats_name){
+        fprintf(stderr, "Error: cannot use the %s stats source: %s\n", source->name, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  if(stats == NULL){
+    fprintf(stderr, "Error: unknown stats source '%s' (taskstats, proc, cgroup or perf)\n", stats_name);
+    exit(EXIT_FAILURE);
+  }
+
+  if(stats_want_io && !delayacct_enabled()){
+    fprintf(stderr, "Note: delay accounting is off (kernel.task_delayacct), I/O is judged by switches and bytes only\n");
+  }
+  if(memory_budget > 0 && stats == &cgroup_stats){
+    fprintf(stderr, "Warning: the cgroup stats source has no RSS figures, '-m' is ignored\n");
+  }else if(memory_budget > 0 && stats == &taskstats_stats){
+    fprintf(stderr, "Warning: the taskstats source only has peak RSS, '-m' is held against that (-S proc for current RSS)\n");
+  }
 
-  pid_array = (pid_t *)malloc(lines * sizeof(pid_t));
-  process_completed = (int *)malloc(lines * sizeof(int));
-  time_slices = (int *)malloc(lines * sizeof(int));
-  if (!pid_array || !process_completed || !time_slices) {
-    perror("Failed to allocate memory for process arrays");
+  if(psi_limit > 0){
+    pressure_fd = open_memory_pressure();
+    if(pressure_fd < 0){
+      fprintf(stderr, "Warning: no /proc/pressure/memory, --psi-limit is ignored\n");
+    }
+  }
+
+  if(load_job_file(filename, &table) < 0){
+    exit(EXIT_FAILURE);
+  }
+  int lines = table.count;
+  total_jobs = lines;
+  setup_cores();
+
+  // Only this many jobs exist at once, the rest are launched as slots free up
+  int window = (max_live > 0 && max_live < lines) ? max_live : lines;
+
+  int resumed = 0;
+  if(state_path && checkpoint_open(state_path, &table, &resumed) < 0){
+    exit(EXIT_FAILURE);
+  }
+  if(resumed){
+    if(cgroup_root){
+      fprintf(stderr, "Error: resuming from %s needs the signal backend, the old run's cgroups cannot be taken over\n", state_path);
+      exit(EXIT_FAILURE);
+    }
+    // Survivors each hold a slot, however small --max-live is now
+    int alive = 0;
+    for(int i = 0; i < lines; i++){
+      alive += checkpoint[i].state == JOB_LAUNCHED;
+    }
+    window = alive > window ? alive : window;
+  }
+
+  tasks = (struct task *)calloc(lines > 0 ? lines : 1, sizeof(struct task));
+  if (!tasks) {
+    perror("Failed to allocate memory for task table");
     exit(EXIT_FAILURE);
   }
 
   for (int i = 0; i < lines; i++) {
-    process_completed[i] = 0;
-    time_slices[i] = TIME_SLICE;
+    tasks[i].index = i;
+    tasks[i].pidfd = -1;
+    tasks[i].stat_fd = -1;
+    tasks[i].status_fd = -1;
+    tasks[i].io_fd = -1;
+    tasks[i].control_fd = -1;
+    tasks[i].stats_fd = -1;
+    for(int k = 0; k < PERF_COUNTERS - 1; k++){
+      tasks[i].perf_fds[k] = -1;
+    }
+    tasks[i].out_fd = -1;
+    tasks[i].out_write = -1;
+    tasks[i].out_file = -1;
+    tasks[i].slice = config.quantum;
+    tasks[i].core = i % config.cores;
+    tasks[i].cpu = -1;
+    tasks[i].nice = table.jobs[i].nice;
+    tasks[i].deadline = table.jobs[i].deadline;
+    tasks[i].runtime = table.jobs[i].runtime;
+    tasks[i].heap_index = -1;
   }
 
-  FILE *file = fopen(argv[2], "r");
-  if (!file) {
-    perror("Error opening file");
-    free(pid_array);
-    free(process_completed);
-    free(time_slices);
+  // History first, EDF's admission check and the critical paths both use the runtimes
+  if(history_path && history_load(history_path, &table, tasks) < 0){
+    exit(EXIT_FAILURE);
+  }
+  if(graph_init(&table, tasks) < 0 || heap_init(&ready, lines) < 0 ||
+     policy->init(tasks, lines) < 0 || task_map_init(lines) < 0){
     exit(EXIT_FAILURE);
   }
+  if(table.num_deps > 0){
+    long long longest = 0;
+    for(int i = 0; i < lines; i++){
+      longest = tasks[i].path_ns > longest ? tasks[i].path_ns : longest;
+    }
+    printf("Graph: %d dependencies, longest critical path %.3fs\n", table.num_deps, longest / 1e9);
+  }
 
-  char line[1024];
+  raise_fd_limit(); // Up to twelve fds per child
 
-  sigset_t sigset;
-  sigemptyset(&sigset);
-  sigaddset(&sigset, SIGUSR1);
-  sigprocmask(SIG_BLOCK, &sigset, NULL);
-  signal(SIGALRM, alarm_handler);
+  if(trace_path && trace_open(trace_path) < 0){
+    exit(EXIT_FAILURE);
+  }
 
-  while(fgets(line, sizeof(line), file) != NULL){
-    line[strcspn(line, "\n")] = '\0';
+  if(report_interval > 0 && report_open(report_format) < 0){
+    exit(EXIT_FAILURE);
+  }
 
-    char *args[MAX_ARGS];
-    char *token = strtok(line, " ");
-    int j = 0;
+  if((output_dir || output_log) && output_open(output_dir, output_log) < 0){
+    exit(EXIT_FAILURE);
+  }
 
-    while (token != NULL && j < MAX_ARGS) {
-      args[j++] = token;
-      token = strtok(NULL, " ");
+  if(cgroup_root && cgroup_setup(cgroup_root, cpu_share) < 0){
+    exit(EXIT_FAILURE);
+  }
+
+  // SIGCHLD is blocked from here on so no exit can slip past the signalfd
+  if(launcher_init(&launcher, fast_start, window) < 0){
+    exit(EXIT_FAILURE);
+  }
+  launcher.survive = state_path != NULL;
+
+  pids = (pid_t *)malloc((window > 0 ? window : 1) * sizeof(pid_t));
+  free_slots = (int *)malloc((window > 0 ? window : 1) * sizeof(int));
+  live = (struct task **)malloc((window > 0 ? window : 1) * sizeof(struct task *));
+  live_stats = (struct task_stats *)malloc((window > 0 ? window : 1) * sizeof(struct task_stats));
+  admitted = (struct task **)malloc((window > 0 ? window : 1) * sizeof(struct task *));
+  skip_stack = (int *)malloc((lines > 0 ? lines : 1) * sizeof(int));
+  if(!pids || !free_slots || !live || !live_stats || !admitted || !skip_stack){
+    perror("Failed to allocate memory for pid array");
+    exit(EXIT_FAILURE);
+  }
+
+  // Popped from the end, so slot 0 goes first
+  for(int i = window - 1; i >= 0; i--){
+    free_slots[num_free_slots++] = i;
+  }
+
+  setup_event_loop();
+  run_start = now_ns();
+  if(resumed){
+    resume_tasks();
+  }
+  for(int i = 0; i < lines; i++){
+    if(!tasks[i].completed && tasks[i].launched_ns == 0 && tasks[i].waiting_on == 0){
+      push_ready(&tasks[i]);
     }
-    args[j] = NULL; // Null terminate for execvp
+  }
+  admit_waiting();
+  reap_children(); // Children that failed to exec may already be gone
 
-    pid_t pid = fork();
-    if(pid < 0){
-      perror("Failed to fork process");
-      fclose(file);
-      free(pid_array);
-      free(process_completed);
-      free(time_slices);
-      exit(EXIT_FAILURE);
-    }else if(pid == 0){
-      fclose(file);
-      int sig;
-      sigwait(&sigset, &sig);
-
-      if(execvp(args[0], args) == -1) {
-        perror("Execvp failed");
-        free(pid_array);
-        free(process_completed);
-        free(time_slices);
-        exit(EXIT_FAILURE);
-      }
-    }else{
-      pid_array[num_processes++] = pid;
+  for(int i = 0; i < config.cores; i++){
+    cores[i].current = policy->pick_next(i);
+    if(cores[i].current){
+      printf("Scheduling Process %d\n", cores[i].current->pid);
+      dispatch(&cores[i], cores[i].current, -1);
     }
   }
-  fclose(file);
+  run_event_loop();
+  trace_close();
+  output_close();
+  checkpoint_close(1);
+  if(report_interval > 0){
+    report_close();
+  }
 
-  signaler(pid_array, num_processes, SIGUSR1);
-  signaler(pid_array, num_processes, SIGSTOP);
+  printf("All child processes have completed.\n");
+  if(switch_count > 0){
+    printf("Dispatch latency: avg %lld us, max %lld us over %lld switches\n",
+      total_latency / switch_count / 1000, max_latency / 1000, switch_count);
+  }
+  report_deadlines();
+  report_memory();
+  if(skipped > 0){
+    printf("Dependencies: %lld jobs skipped after a job they wait for failed\n", skipped);
+  }
+  if(early_preemptions > 0){
+    printf("Early preemptions: %lld slices handed on because the job had gone to sleep\n", early_preemptions);
+  }
+  if(results){
+    write_results(results);
+  }
+  if(history_path){
+    history_save(history_path, &table, tasks);
+  }
+  if(control_count > 0){
+    printf("Switch cost (%s): avg %lld ns per stop or resume over %lld calls\n",
+      control->name, control_time / control_count, control_count);
+  }
 
-  if (num_processes > 0) {
-    printf("Scheduling Process %d\n", pid_array[current_process]);
-    kill(pid_array[current_process], SIGCONT);
-    alarm(time_slices[current_process]);
+  close(epoll_fd);
+  for(int i = 0; i < config.cores; i++){
+    close(cores[i].timer_fd);
+  }
+  close(signal_fd);
+  if(report_fd >= 0){
+    close(report_fd);
+  }
+  if(block_fd >= 0){
+    close(block_fd);
+  }
+  if(pressure_fd >= 0){
+    close(pressure_fd);
+  }
+  launcher_destroy(&launcher);
+  free(pids);
+  free(free_slots);
+  free(admitted);
+  free(skip_stack);
+  free(ready.items);
+  free(live);
+  free(live_stats);
+  if(cgroup_root){
+    cgroup_cleanup();
   }
+  free_job_table(&table);
+  free(tasks);
+  free(cores);
+  return 0;
+}
 
-  for(int i = 0; i < num_processes; i++){
-    if(!process_completed[i]){
-      if(waitpid(pid_array[i], NULL, 0) < 0){
-        perror("Waitpid failed");
+// Launches the job on this line into a launcher slot, held until the next
+// launcher_release()
+void admit_task(int index, int slot){
+  struct task *task = &tasks[index];
+  if(capturing && output_attach(task) < 0){
+    exit(EXIT_FAILURE);
+  }
+  pid_t pid = launch_job(&launcher, &table.jobs[index], slot, task->out_write);
+  if(pid < 0){
+    perror("Failed to fork process");
+    exit(EXIT_FAILURE);
+  }
+  task->pid = pid;
+  task->slot = slot;
+  task->launched_ns = now_ns();
+  task_map_add(task);
+  task->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if(control->attach(task) < 0 || stats->attach(task) < 0){
+    exit(EXIT_FAILURE);
+  }
+  checkpoint_launch(task);
+}
+
+// Fills free slots from the ready jobs: whatever a resumed run has to start
+// again, then the longest critical path first, or line order for a batch
+// without @after=
+void admit_waiting(){
+  int count = 0;
+  while(num_free_slots > 0 && ready.count > 0){
+    int index = heap_pop(&ready)->index;
+    admit_task(index, free_slots[--num_free_slots]);
+    admitted[count] = &tasks[index];
+    pids[count++] = tasks[index].pid;
+  }
+
+  launcher_release(&launcher, pids, count);
+  for(int i = 0; i < count; i++){
+    control->start(admitted[i]);
+    watch_task(admitted[i]);
+    policy->enqueue(admitted[i]);
+  }
+}
+
+// Takes a batch up again from its state file. Finished jobs stay finished
+// and release what waits on them, jobs still alive are re-attached. Jobs
+// that died with the old scheduler keep their JOB_LAUNCHED record until they
+// are launched again, which puts them first in line.
+void resume_tasks(){
+  int done = 0;
+  int adopted = 0;
+  int lost = 0;
+  for(int i = 0; i < total_jobs; i++){
+    struct task *task = &tasks[i];
+    if(checkpoint[i].state == JOB_DONE){
+      task->completed = 1;
+      task->status = checkpoint[i].status;
+      if(task->status != -2){
+        task->launched_ns = task->first_run_ns = task->exited_ns = run_start;
+      }
+      finished_processes++;
+      done++;
+    }else if(checkpoint[i].state == JOB_LAUNCHED){
+      if(adopt_task(task, &checkpoint[i]) == 0){
+        task->launched_ns = task->first_run_ns = run_start;
+        adopted++;
       }else{
-        process_completed[i] = 1;
+        lost++;
       }
     }
   }
+  for(int i = 0; i < total_jobs; i++){
+    if(checkpoint[i].state == JOB_DONE){
+      release_dependents(&tasks[i], 0);
+    }
+  }
+  printf("Resuming: %d jobs done, %d re-attached, %d to run again, %d not started\n",
+    done, adopted, lost, total_jobs - done - adopted - lost);
+}
+
+// The pid must still be the job we launched, not a reuse, which its start
+// time tells. It is no longer our child, so its exit comes only from the
+// pidfd and without a status.
+int adopt_task(struct task *task, struct checkpoint_record *record){
+  struct proc_stat stat;
+  if(read_proc_stat(-1, record->pid, &stat) < 0 || stat.starttime != record->starttime || stat.state == 'Z'){
+    return -1;
+  }
+  int pidfd = syscall(SYS_pidfd_open, record->pid, 0);
+  if(pidfd < 0){
+    // Unwatchable, so it is run again rather than twice
+    fprintf(stderr, "Warning: cannot watch surviving job %d, restarting it\n", record->pid);
+    kill(record->pid, SIGKILL);
+    return -1;
+  }
 
-  free(pid_array);
-  free(process_completed);
-  free(time_slices);
+  task->pid = record->pid;
+  task->pidfd = pidfd;
+  task->adopted = 1;
+  task->slot = free_slots[--num_free_slots];
+  task->slice = record->slice > 0 ? record->slice : config.quantum;
+  task->level = record->level;
+  task->vruntime = record->vruntime;
+  task_map_add(task);
+  if(control->attach(task) < 0 || stats->attach(task) < 0){
+    exit(EXIT_FAILURE);
+  }
+  // It may have been running when the old scheduler died
+  control->stop(task);
+  control->start(task);
+
+  struct task_stats sample;
+  if(stats->read(task, &sample) == 0){
+    task->last_cpu_ns = sample.cpu_ns;
+    task->last_switches = sample.switches;
+    task->last_blkio_ns = sample.blkio_ns;
+    task->last_io = sample.io;
+  }
+  watch_task(task);
+  policy->enqueue(task);
   return 0;
 }
 
-void adjust_time_slice(int index){
-  if(waitpid(pid_array[index], NULL, WNOHANG) == 0){
-    char path[40];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid_array[index]);
-    FILE *file = fopen(path, "r");
-
-    if(file){
-      long utime, stime;
-      if(fscanf(file, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2){
-        if (utime > stime) { // More utime might indicate CPU-bound
-          time_slices[index] = TIME_SLICE + 1;
-        } else {
-          time_slices[index] = (TIME_SLICE - 1 > MIN_TIME_SLICE) ? TIME_SLICE - 1 : MIN_TIME_SLICE;
-        }
-      }
-      fclose(file);
-    }else{
-      perror("Error opening /proc/[pid]/stat for time slice adjustment");
+void watch_task(struct task *task){
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  if(task->pidfd >= 0){
+    ev.data.u64 = (uint64_t)task->index;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, task->pidfd, &ev);
+  }
+  if(task->out_fd >= 0){
+    ev.data.u64 = (uint64_t)OUTPUT_TAG(task->index);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, task->out_fd, &ev);
+  }
+}
+
+// Gives each -j slot one of the CPUs we may run on. With a single slot
+// nothing is pinned and the kernel places the job as before.
+void setup_cores(){
+  cores = (struct core *)calloc(config.cores, sizeof(struct core));
+  if(!cores){
+    perror("Failed to allocate cores");
+    exit(EXIT_FAILURE);
+  }
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0){
+    perror("sched_getaffinity failed");
+    exit(EXIT_FAILURE);
+  }
+  int available = CPU_COUNT(&allowed);
+  if(config.cores > available){
+    fprintf(stderr, "Warning: %d cores requested but only %d CPUs available, some will be shared\n",
+      config.cores, available);
+  }
+
+  int cpu = -1;
+  for(int i = 0; i < config.cores; i++){
+    do{
+      cpu = (cpu + 1) % CPU_SETSIZE;
+    }while(!CPU_ISSET(cpu, &allowed));
+    cores[i].cpu = cpu;
+    cores[i].timer_fd = -1;
+  }
+}
+
+#define MAX_LISTED_MISSES 20
+
+// How jobs with an @deadline= fared, under whichever policy ran them
+void report_deadlines(){
+  int with_deadline = 0;
+  int missed = 0;
+  long long total_lateness = 0;
+  long long max_lateness = 0;
+
+  for(int i = 0; i < total_jobs; i++){
+    struct task *task = &tasks[i];
+    if(task->deadline == 0 || task->launched_ns == 0){
+      continue;
     }
-  }else{
-    fprintf(stderr, "Process %d has already terminated, skipping time slice adjustment.\n", pid_array[index]);
+    with_deadline++;
+    long long lateness = (task->exited_ns - run_start) - task->deadline;
+    if(lateness <= 0){
+      continue;
+    }
+    missed++;
+    total_lateness += lateness;
+    if(lateness > max_lateness){
+      max_lateness = lateness;
+    }
+    if(missed <= MAX_LISTED_MISSES){
+      printf("  Missed: job %d (line %d, pid %d) done at %.3fs, due %.3fs, %.1f ms late%s\n",
+        i + 1, table.jobs[i].line, task->pid, (task->exited_ns - run_start) / 1e9,
+        task->deadline / 1e9, lateness / 1e6, task->best_effort ? ", not admitted" : "");
+    }
+  }
+  if(with_deadline == 0){
+    return;
+  }
+  if(missed > MAX_LISTED_MISSES){
+    printf("  ... and %d more\n", missed - MAX_LISTED_MISSES);
+  }
+  printf("Deadlines: %d of %d met", with_deadline - missed, with_deadline);
+  if(missed > 0){
+    printf(", mean lateness %.1f ms, max %.1f ms", total_lateness / 1e6 / missed, max_lateness / 1e6);
   }
+  printf("\n");
 }
 
-void display_process_info(){
-  printf("\nPID\tutime\tstime\ttime\tnice\tvirt mem\n");
+// Raw numbers for schedbench: run totals, then one line per job with its
+// launch, first dispatch and exit times in ns
+void write_results(const char *path){
+  FILE *file = fopen(path, "w");
+  if(!file){
+    perror("Failed to open results file");
+    return;
+  }
 
-  long clock_ticks_per_sec = sysconf(_SC_CLK_TCK);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long long cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+    (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
 
-  for(int i = 0; i < num_processes; i++){
-    if(process_completed[i]){
+  fprintf(file, "policy %s\n", policy->name);
+  fprintf(file, "makespan_ns %lld\n", run_end - run_start);
+  fprintf(file, "switches %lld\n", switch_count);
+  fprintf(file, "sched_cpu_ns %lld\n", cpu);
+  for(int i = 0; i < total_jobs; i++){
+    if(tasks[i].launched_ns == 0){
       continue;
     }
+    fprintf(file, "job %d %lld %lld %lld\n", tasks[i].index,
+      tasks[i].launched_ns - run_start,
+      tasks[i].first_run_ns ? tasks[i].first_run_ns - run_start : -1,
+      tasks[i].exited_ns - run_start);
+  }
+  fclose(file);
+}
 
-    char path[40];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid_array[i]);
-    FILE *file = fopen(path, "r");
+// Children hold up to twelve fds each, so large batches need more than the soft limit
+void raise_fd_limit(){
+  struct rlimit limit;
+  if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
 
-    if(file){
-      long utime, stime;
-      unsigned long vsize;
-      int nice;
-      float total_time;
+void setup_event_loop(){
+  struct epoll_event ev;
 
-      if(fscanf(file, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %d %*d %*d %*d %*d %*d %lu", &utime, &stime, &nice, &vsize) != 4){
-        fprintf(stderr, "Error reading utime, stime, nice, and vsize for PID %d\n", pid_array[i]);
-        fclose(file);
-        exit(EXIT_FAILURE);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(epoll_fd < 0){
+    perror("Failed to create scheduler event loop");
+    exit(EXIT_FAILURE);
+  }
+
+  // Stopping a child on every quantum would otherwise raise SIGCHLD too
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_DFL;
+  sa.sa_flags = SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  sigset_t chld_set;
+  sigemptyset(&chld_set);
+  sigaddset(&chld_set, SIGCHLD);
+  signal_fd = signalfd(-1, &chld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+  if(signal_fd < 0){
+    perror("Failed to create signalfd");
+    exit(EXIT_FAILURE);
+  }
+
+  ev.events = EPOLLIN;
+  for(int i = 0; i < config.cores; i++){
+    cores[i].timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(cores[i].timer_fd < 0){
+      perror("Failed to create quantum timer");
+      exit(EXIT_FAILURE);
+    }
+    ev.data.u64 = (uint64_t)TIMER_TAG(i);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cores[i].timer_fd, &ev);
+  }
+  ev.data.u64 = (uint64_t)SIGNAL_TAG;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+  if(report_interval > 0){
+    struct itimerspec its;
+    its.it_value.tv_sec = its.it_interval.tv_sec = report_interval / 1000000000LL;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = report_interval % 1000000000LL;
+    report_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(report_fd < 0 || timerfd_settime(report_fd, 0, &its, NULL) < 0){
+      perror("Failed to create report timer");
+      exit(EXIT_FAILURE);
+    }
+    ev.data.u64 = (uint64_t)REPORT_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, report_fd, &ev);
+  }
+
+  if(block_check > 0){
+    struct itimerspec its;
+    its.it_value.tv_sec = its.it_interval.tv_sec = block_check / 1000000000LL;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = block_check % 1000000000LL;
+    block_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(block_fd < 0 || timerfd_settime(block_fd, 0, &its, NULL) < 0){
+      perror("Failed to create block check timer");
+      exit(EXIT_FAILURE);
+    }
+    ev.data.u64 = (uint64_t)BLOCK_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, block_fd, &ev);
+  }
+}
+
+void run_event_loop(){
+  struct epoll_event events[MAX_EVENTS];
+
+  while(finished_processes < total_jobs){
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
       }
-      fclose(file);
-      total_time = (float)(utime + stime) / clock_ticks_per_sec;
-
-      printf("%d - %0.6f %0.6f %0.6f    %d  %lu\n",
-        pid_array[i],
-        (float)utime / clock_ticks_per_sec,
-        (float)stime / clock_ticks_per_sec,
-        total_time, nice, vsize);
-    }else{
-      fprintf(stderr, "Error opening /proc/%d/stat\n", pid_array[i]);
+      perror("epoll_wait failed");
       exit(EXIT_FAILURE);
     }
+
+    int exited = 0;
+    int report_due = 0;
+    int check_due = 0;
+    for(int i = 0; i < n; i++){
+      int tag = (int)events[i].data.u64;
+      if(tag <= TIMER_TAG(0)){
+        struct core *core = &cores[TIMER_TAG(0) - tag];
+        uint64_t expirations;
+        // Re-arming the timer clears expirations that were already reported
+        if(read(core->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+          core->expired = 1;
+        }
+      }else if(tag == REPORT_TAG){
+        uint64_t expirations;
+        read(report_fd, &expirations, sizeof(expirations));
+        report_due = 1;
+      }else if(tag == BLOCK_TAG){
+        uint64_t expirations;
+        read(block_fd, &expirations, sizeof(expirations));
+        check_due = 1;
+      }else if(tag == SIGNAL_TAG){
+        struct signalfd_siginfo info;
+        while(read(signal_fd, &info, sizeof(info)) == sizeof(info));
+        exited = 1;
+      }else if(tag >= OUTPUT_TAG(0)){
+        output_drain(&tasks[tag - OUTPUT_TAG(0)]);
+      }else{
+        struct task *task = &tasks[tag];
+        if(task->adopted && !task->completed){
+          finish_task(task, -1);
+        }
+        exited = 1;
+      }
+    }
+
+    if(exited){
+      reap_children();
+      if(num_free_slots > 0 && ready.count > 0){
+        admit_waiting();
+      }
+    }
+    if(check_due){
+      check_blocked();
+    }
+    // Switch on quantum expiry, or straight away if the running job exited.
+    // Idle cores look again each round in case there is work to steal.
+    for(int i = 0; i < config.cores && finished_processes < total_jobs; i++){
+      struct core *core = &cores[i];
+      if(core->expired || core->current == NULL || core->current->completed){
+        schedule_next(core);
+      }
+    }
+    // Only once every core has been seen to
+    if(report_due){
+      display_process_info();
+    }
   }
 }
 
-void alarm_handler(int sig){ // Round Robin implementation
+void reap_children(){
   int status;
-  if(waitpid(pid_array[current_process], &status, WNOHANG) > 0){
-    if(WIFEXITED(status) || WIFSIGNALED(status)){
+  pid_t pid;
+  struct rusage usage;
+  while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0){
+    if(!WIFEXITED(status) && !WIFSIGNALED(status)){
+      continue;
+    }
+    struct task *task = task_map_find(pid);
+    if(task == NULL || task->completed){
+      continue;
+    }
+    // Exact, and including anything it waited for, for --history
+    task->last_cpu_ns = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+    finish_task(task, status);
+  }
+}
+
+// status is -1 for an adopted job, whose exit status went to someone else
+void finish_task(struct task *task, int status){
+  task->completed = 1;
+  task->status = status;
+  finished_processes++;
+  task->exited_ns = run_end = now_ns();
+  checkpoint_finish(task, status);
+  if(tracing){
+    trace_event(TRACE_EXIT, task->core, task->pid, status, 0);
+  }
+  if(task->queue == &blocked || task->queue == &woken){
+    queue_remove(task);
+  }else{
+    policy->remove(task); // In case it exited while queued, e.g. killed from outside
+  }
+  if(task->pidfd >= 0){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, task->pidfd, NULL);
+    close(task->pidfd);
+    task->pidfd = -1;
+  }
+  if(task->out_fd >= 0){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, task->out_fd, NULL);
+    output_release(task);
+  }
+  stats->release(task);
+  control->release(task);
+  launcher_reclaim(&launcher, task->slot);
+  free_slots[num_free_slots++] = task->slot;
+  release_dependents(task, 1);
+}
+
+// Queues a job to be launched once a slot is free
+void push_ready(struct task *task){
+  if(checkpoint && checkpoint[task->index].state == JOB_LAUNCHED){
+    task->key = LLONG_MIN; // Lost with the old scheduler
+  }else{
+    task->key = table.num_deps > 0 ? -task->path_ns : task->index;
+  }
+  heap_push(&ready, task);
+}
+
+// Counts a finished job off everything waiting on it. A job that failed, or
+// was itself skipped, takes its dependents down with it. When resuming the
+// counts are only brought up to date, the ready jobs are queued afterwards.
+void release_dependents(struct task *task, int push){
+  int status = task->status;
+  if(status != -1 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)){
+    skip_dependents(task);
+    return;
+  }
+  for(int k = 0; k < task->num_dependents; k++){
+    struct task *next = &tasks[task->dependents[k]];
+    if(--next->waiting_on == 0 && push && !next->completed && next->launched_ns == 0){
+      push_ready(next);
+    }
+  }
+}
+
+// Marks everything downstream of a failed job done without running it,
+// through a worklist as a long pipeline would be a deep recursion
+void skip_dependents(struct task *task){
+  int count = 0;
+  skip_stack[count++] = task->index;
+  while(count > 0){
+    struct task *failed = &tasks[skip_stack[--count]];
+    for(int k = 0; k < failed->num_dependents; k++){
+      struct task *next = &tasks[failed->dependents[k]];
+      if(next->completed || next->launched_ns != 0){
+        continue;
+      }
+      next->completed = 1;
+      next->status = -2;
+      next->exited_ns = now_ns();
       finished_processes++;
-      process_completed[current_process] = 1;
-      if (finished_processes == num_processes) {
-        printf("All child processes have completed.\n");
-        free(pid_array);
-        free(process_completed);
-        free(time_slices);
-        exit(0);
+      skipped++;
+      checkpoint_finish(next, -2);
+      skip_stack[count++] = next->index;
+    }
+  }
+}
+
+// latency is how late this switch came after the last slice's deadline, -1
+// when the core was idle or its job had exited
+void dispatch(struct core *core, struct task *task, long long latency){
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = task->slice / 1000000000LL;
+  its.it_value.tv_nsec = task->slice % 1000000000LL;
+
+  // Only move the job when it lands on a different CPU, e.g. after a steal
+  if(config.cores > 1 && task->cpu != core->cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core->cpu, &set);
+    if(sched_setaffinity(task->pid, sizeof(set), &set) == 0){
+      task->cpu = core->cpu;
+    }
+  }
+
+  long long start = now_ns();
+  control->resume(task);
+  control_time += now_ns() - start;
+  if(task->first_run_ns == 0){
+    task->first_run_ns = start;
+  }
+  task->asleep = 0;
+  control_count++;
+  timerfd_settime(core->timer_fd, 0, &its, NULL);
+  core->slice_deadline = now_ns() + task->slice;
+  if(tracing){
+    trace_event(TRACE_DISPATCH, core - cores, task->pid, task->slice, latency);
+  }
+}
+
+// Fills in what the task did since it last came off the CPU
+void sample_task(struct task *task, struct tick *tick){
+  memset(tick, 0, sizeof(*tick));
+  tick->expired = 1;
+
+  struct task_stats sample;
+  if(stats->read(task, &sample) < 0){
+    fprintf(stderr, "Error reading %s stats of %d for time slice adjustment\n", stats->name, task->pid);
+    return;
+  }
+  tick->stat = sample.stat;
+  tick->cpu_ns = sample.cpu_ns - task->last_cpu_ns;
+  task->last_cpu_ns = sample.cpu_ns;
+  task->rss = (long long)sample.stat.rss * page_size;
+
+  if(policy->needs_io){
+    tick->voluntary = sample.switches.voluntary - task->last_switches.voluntary;
+    tick->involuntary = sample.switches.involuntary - task->last_switches.involuntary;
+    tick->blkio_ns = sample.blkio_ns - task->last_blkio_ns;
+    tick->io_bytes = (sample.io.rchar + sample.io.wchar) - (task->last_io.rchar + task->last_io.wchar);
+    task->last_switches = sample.switches;
+    task->last_blkio_ns = sample.blkio_ns;
+    task->last_io = sample.io;
+  }
+}
+
+// Runs after the cores are served, the reporter thread does the writing
+void display_process_info(){
+  int count = 0;
+  for(int i = 0; i < total_jobs; i++){
+    if(tasks[i].launched_ns != 0 && !tasks[i].completed){
+      live[count++] = &tasks[i];
+    }
+  }
+  stats->read_all(live, count, live_stats);
+
+  report_begin(now_ns() - run_start);
+  for(int i = 0; i < count; i++){
+    if(live_stats[i].ok){ // Otherwise most likely exited and not reaped yet
+      report_row(live[i]->pid, &live_stats[i]);
+    }
+  }
+  report_end();
+}
+
+void schedule_next(struct core *core){
+  struct task *current = core->current;
+  int expired = core->expired && current != NULL && !current->completed;
+  core->expired = 0;
+  if(expired){
+    long long start = now_ns();
+    control->stop(current);
+    control_time += now_ns() - start;
+    control_count++;
+
+    struct tick tick;
+    sample_task(current, &tick);
+    long long old_slice = current->slice;
+    policy->update(current, &tick);
+    policy->enqueue(current);
+    checkpoint_save(current);
+    if(tracing){
+      int index = core - cores;
+      trace_event(TRACE_PREEMPT, index, current->pid, tick.cpu_ns, 0);
+      trace_event(TRACE_SAMPLE, index, current->pid, current->last_cpu_ns, tick.voluntary);
+      if(current->slice != old_slice){
+        trace_event(TRACE_SLICE, index, current->pid, current->slice, old_slice);
       }
     }
-  }else{
-    kill(pid_array[current_process], SIGSTOP);
   }
 
-  display_counter++;
-  if(display_counter % 2 == 0){
-    display_process_info();
+  int from_woken = woken.count > 0;
+  current = from_woken ? queue_pop(&woken) : policy->pick_next(core - cores);
+  if(memory_budget > 0 || pressure_fd >= 0){
+    // Jobs that would not fit go back to their queue and the next is tried,
+    // so a large job waits for memory rather than holding up smaller ones.
+    // Woken jobs go back to woken, the policy never saw them leave.
+    struct task *deferred[MAX_DEFERRED];
+    int deferred_woken[MAX_DEFERRED];
+    int num_deferred = 0;
+    while(current && !fits_in_memory(core, current)){
+      deferrals++;
+      deferred_woken[num_deferred] = from_woken;
+      deferred[num_deferred++] = current;
+      current = NULL;
+      if(num_deferred < MAX_DEFERRED){
+        from_woken = woken.count > 0;
+        current = from_woken ? queue_pop(&woken) : policy->pick_next(core - cores);
+      }
+    }
+    for(int i = 0; i < num_deferred; i++){
+      if(deferred_woken[i]){
+        queue_push(&woken, deferred[i]);
+      }else{
+        policy->enqueue(deferred[i]);
+      }
+    }
   }
+  core->current = current;
+  if(current){
+    //printf("Scheduling Process %d\n", current->pid);
+    long long latency = -1;
+    if(expired){
+      latency = now_ns() - core->slice_deadline;
+      switch_count++;
+      total_latency += latency;
+      if(latency > max_latency){
+        max_latency = latency;
+      }
+    }
+    dispatch(core, current, latency);
+  }
+}
+
+// Whether resuming task on core keeps the running jobs within -m and, with
+// --psi-limit, whether the system has room for more than one job at all.
+// RSS is as of each job's last sample, and a core is never refused while
+// every other core is idle so an oversized job still gets to run alone.
+int fits_in_memory(struct core *core, struct task *task){
+  long long running_rss = 0;
+  int running = 0;
+  for(int i = 0; i < config.cores; i++){
+    struct task *other = cores[i].current;
+    if(&cores[i] != core && other && !other->completed){
+      running_rss += other->rss;
+      running++;
+    }
+  }
+  long long total = running_rss + task->rss;
+  if(running == 0){
+    max_running_rss = total > max_running_rss ? total : max_running_rss;
+    return 1;
+  }
+
+  if(memory_budget > 0 && total > memory_budget){
+    return 0;
+  }
+
+  if(pressure_fd >= 0){
+    long long now = now_ns();
+    if(now - last_pressure_read >= PRESSURE_INTERVAL){
+      last_pressure_read = now;
+      read_memory_pressure(pressure_fd, &memory_pressure);
+    }
+    if(memory_pressure > psi_limit){
+      return 0;
+    }
+  }
+
+  max_running_rss = total > max_running_rss ? total : max_running_rss;
+  return 1;
+}
+
+void report_memory(){
+  if(memory_budget == 0 && pressure_fd < 0){
+    return;
+  }
+  printf("Memory: %lld deferrals, peak running RSS %.1f MB", deferrals, max_running_rss / 1048576.0);
+  if(memory_budget > 0){
+    printf(" of %.1f MB budget", memory_budget / 1048576.0);
+  }
+  if(pressure_fd >= 0){
+    printf(", memory pressure %.2f%% at last read", memory_pressure);
+  }
+  printf("\n");
+}
 
-  adjust_time_slice(current_process);
-  current_process = (current_process + 1) % num_processes;
+// The --block-check sub-tick. A job seen sleeping at two looks in a row with
+// no CPU time gained in between has blocked, and if anything else is ready
+// its core goes to that job for the rest of the slice. The state comes from
+// /proc, the CPU time from the stats source, so with -S cgroup a shell asleep
+// in wait() while its children compute is not taken for blocked. The sleeper
+// is left running rather than stopped, a stopped job could never be seen to
+// wake. Once it is running again, or has gained CPU time, it is stopped and
+// put ahead of everything the policy has queued. Woken jobs are looked at
+// first so they are in line before this round's switches.
+void check_blocked(){
+  struct proc_stat stat;
+  struct task_stats sample;
+  struct task *next;
+  for(struct task *task = blocked.head; task; task = next){
+    next = task->next;
+    if(read_proc_stat(task->stat_fd, task->pid, &stat) < 0 || stat.state == 'Z' ||
+       stats->read(task, &sample) < 0){
+      continue; // Exited, the reaper will have it
+    }
+    if(stat.state == 'R' || sample.cpu_ns != task->block_cpu_ns){
+      control->stop(task);
+      queue_remove(task);
+      queue_push(&woken, task);
+      if(tracing){
+        trace_event(TRACE_WAKE, task->core, task->pid, 0, 0);
+      }
+    }
+  }
 
-  int start = current_process;
-  while(finished_processes < num_processes){
-    if(waitpid(pid_array[current_process], &status, WNOHANG) == 0){
-      //printf("Scheduling Process %d\n", pid_array[current_process]);
-      kill(pid_array[current_process], SIGCONT);
-      alarm(time_slices[current_process]);
-      break;
+  for(int i = 0; i < config.cores; i++){
+    struct task *task = cores[i].current;
+    if(task == NULL || task->completed ||
+       read_proc_stat(task->stat_fd, task->pid, &stat) < 0 || stats->read(task, &sample) < 0){
+      continue;
+    }
+    int sleeping = stat.state == 'S' || stat.state == 'D';
+    if(sleeping && task->asleep && sample.cpu_ns == task->block_cpu_ns){
+      preempt_blocked(&cores[i]);
+    }else{
+      task->asleep = sleeping;
+      task->block_cpu_ns = sample.cpu_ns;
     }
-    current_process = (current_process + 1) % num_processes;
-    if(current_process == start)break;
   }
 }
 
-void signaler(pid_t *pid_array, int size, int signal){
-  for(int i = 0; i < size; i++){
-    // printf("Parent process: Sending signal %d to child process %d\n", signal, pid_array[i]);
-    kill(pid_array[i], signal);
+// Hands a core whose job is asleep to the next ready one. With nothing else
+// to run the sleeper keeps it, so an idle system pays nothing for the check.
+void preempt_blocked(struct core *core){
+  struct task *current = core->current;
+  int from_woken = woken.count > 0;
+  struct task *next = from_woken ? queue_pop(&woken) : policy->pick_next(core - cores);
+  if(next && (memory_budget > 0 || pressure_fd >= 0) && !fits_in_memory(core, next)){
+    deferrals++;
+    if(from_woken){
+      queue_push(&woken, next);
+    }else{
+      policy->enqueue(next);
+    }
+    next = NULL;
   }
-}
\ No newline at end of file
+  if(next == NULL){
+    return;
+  }
+
+  struct tick tick;
+  sample_task(current, &tick);
+  tick.expired = 0;
+  tick.blocked = 1;
+  long long old_slice = current->slice;
+  policy->update(current, &tick);
+  queue_push(&blocked, current);
+  checkpoint_save(current);
+  early_preemptions++;
+  if(tracing){
+    int index = core - cores;
+    trace_event(TRACE_BLOCK, index, current->pid, tick.cpu_ns, 0);
+    if(current->slice != old_slice){
+      trace_event(TRACE_SLICE, index, current->pid, current->slice, old_slice);
+    }
+  }
+
+  core->current = next;
+  core->expired = 0; // The old slice's timer may have fired this round too
+  dispatch(core, next, -1);
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sched.h"
+
+// Completely-fair-style policy. Each task's CPU time, as measured from
+// /proc, is charged to its vruntime scaled by 1024 / weight, and each core
+// always runs the queued task with the smallest vruntime. The slice is the
+// quantum scaled by the same weight, so over time every job gets a share of
+// the CPU proportional to its weight.
+
+#define NICE_0_WEIGHT 1024
+#define MAX_SLICE_SCALE 8
+
+// The kernel's nice to weight table, each step is about 1.25x
+static const int nice_weights[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+  9548, 7620, 6100, 4904, 3906,
+  3121, 2501, 1991, 1586, 1277,
+  1024, 820, 655, 526, 423,
+  335, 272, 215, 172, 137,
+  110, 87, 70, 56, 45,
+  36, 29, 23, 18, 15,
+};
+
+static struct task_heap *heaps; // One per core, keyed by vruntime
+static long long *min_vruntime; // Per core, never goes backwards
+
+static int weight_of(struct task *task){
+  return nice_weights[task->nice + 20];
+}
+
+// Fairness comes from vruntime alone, the slice only sets how often a job is
+// switched, so it is kept within a sensible range
+static long long slice_for(struct task *task){
+  long long slice = config.quantum * weight_of(task) / NICE_0_WEIGHT;
+  if(slice < MIN_TIME_SLICE){
+    return MIN_TIME_SLICE;
+  }
+  if(slice > config.quantum * MAX_SLICE_SCALE){
+    return config.quantum * MAX_SLICE_SCALE;
+  }
+  return slice;
+}
+
+static int cfs_init(struct task *tasks, int count){
+  heaps = (struct task_heap *)calloc(config.cores, sizeof(struct task_heap));
+  min_vruntime = (long long *)calloc(config.cores, sizeof(long long));
+  if(!heaps || !min_vruntime){
+    perror("Failed to allocate run queues");
+    return -1;
+  }
+  for(int i = 0; i < config.cores; i++){
+    if(heap_init(&heaps[i], count) < 0){
+      return -1;
+    }
+  }
+  for(int i = 0; i < count; i++){
+    tasks[i].vruntime = -1; // Placed when first queued
+    tasks[i].slice = slice_for(&tasks[i]);
+  }
+  return 0;
+}
+
+static void cfs_enqueue(struct task *task){
+  // A newcomer starts level with the core rather than at zero, or it would
+  // hold the CPU until it had caught up with everything already running
+  if(task->vruntime < min_vruntime[task->core]){
+    task->vruntime = min_vruntime[task->core];
+  }
+  task->key = task->vruntime;
+  heap_push(&heaps[task->core], task);
+}
+
+static struct task *take(int core){
+  struct task *task = heap_pop(&heaps[core]);
+  if(task->vruntime > min_vruntime[core]){
+    min_vruntime[core] = task->vruntime;
+  }
+  return task;
+}
+
+static struct task *cfs_pick_next(int core){
+  if(heaps[core].count > 0){
+    return take(core);
+  }
+
+  // Steal the most deserving task of the busiest core, keeping its lead
+  // over that core's minimum when it moves to ours
+  int victim = -1;
+  for(int i = 0; i < config.cores; i++){
+    if(i != core && heaps[i].count > 0 && (victim < 0 || heaps[i].count > heaps[victim].count)){
+      victim = i;
+    }
+  }
+  if(victim < 0){
+    return NULL;
+  }
+  struct task *task = take(victim);
+  task->vruntime += min_vruntime[core] - min_vruntime[victim];
+  task->core = core;
+  return task;
+}
+
+static void cfs_update(struct task *task, struct tick *tick){
+  task->vruntime += tick->cpu_ns * NICE_0_WEIGHT / weight_of(task);
+  task->slice = slice_for(task);
+}
+
+static void cfs_remove(struct task *task){
+  heap_remove(&heaps[task->core], task);
+}
+
+struct policy cfs_policy = {
+  .name = "cfs",
+  .needs_io = 0,
+  .init = cfs_init,
+  .enqueue = cfs_enqueue,
+  .pick_next = cfs_pick_next,
+  .update = cfs_update,
+  .remove = cfs_remove,
+};
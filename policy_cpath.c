@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sched.h"
+
+// Critical path first, for batches with @after= dependencies. Each core runs
+// the queued task with the most expected work still ahead of it: what is
+// left of its own runtime plus the longest chain of jobs waiting on it. Jobs
+// that hold up the most of the batch get the CPU first, the rest fill in
+// around them, as in list scheduling.
+
+static struct task_heap *heaps; // One per core, keyed by remaining path, longest first
+
+static int cpath_init(struct task *tasks, int count){
+  heaps = (struct task_heap *)calloc(config.cores, sizeof(struct task_heap));
+  if(!heaps){
+    perror("Failed to allocate run queues");
+    return -1;
+  }
+  for(int i = 0; i < config.cores; i++){
+    if(heap_init(&heaps[i], count) < 0){
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// A job that overruns its estimate keeps the path of the jobs behind it
+static long long remaining(struct task *task){
+  long long own = task->runtime > 0 ? task->runtime : config.quantum;
+  long long used = task->last_cpu_ns < own ? task->last_cpu_ns : own;
+  return task->path_ns - used;
+}
+
+static void cpath_enqueue(struct task *task){
+  task->key = -remaining(task);
+  heap_push(&heaps[task->core], task);
+}
+
+static struct task *cpath_pick_next(int core){
+  if(heaps[core].count > 0){
+    return heap_pop(&heaps[core]);
+  }
+
+  // Steal whichever other core's front task has the longest path
+  int victim = -1;
+  for(int i = 0; i < config.cores; i++){
+    if(i != core && heaps[i].count > 0 &&
+       (victim < 0 || heaps[i].items[0]->key < heaps[victim].items[0]->key)){
+      victim = i;
+    }
+  }
+  if(victim < 0){
+    return NULL;
+  }
+  struct task *task = heap_pop(&heaps[victim]);
+  task->core = core;
+  return task;
+}
+
+static void cpath_update(struct task *task, struct tick *tick){
+  task->slice = config.quantum;
+}
+
+static void cpath_remove(struct task *task){
+  heap_remove(&heaps[task->core], task);
+}
+
+struct policy cpath_policy = {
+  .name = "cpath",
+  .needs_io = 0,
+  .init = cpath_init,
+  .enqueue = cpath_enqueue,
+  .pick_next = cpath_pick_next,
+  .update = cpath_update,
+  .remove = cpath_remove,
+};
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "sched.h"
+
+// Earliest deadline first. Each core runs its queued task with the nearest
+// @deadline=, jobs without one run only when nothing with a deadline is
+// waiting. At start the jobs that give an @runtime= go through a demand
+// check: taken in deadline order, the CPU time due by each deadline must
+// fit in the cores available until then, and no one job may need more
+// than its own deadline since it runs on one core. Jobs that do not fit
+// are run best effort, behind every admitted deadline, rather than making
+// the others late as well.
+
+static struct task_heap *heaps; // One per core, keyed by deadline
+
+static int by_deadline(const void *a, const void *b){
+  const struct task *x = *(struct task * const *)a;
+  const struct task *y = *(struct task * const *)b;
+  if(x->deadline != y->deadline){
+    return x->deadline < y->deadline ? -1 : 1;
+  }
+  return x->index - y->index;
+}
+
+static int admit(struct task *tasks, int count){
+  struct task **order = (struct task **)malloc((count > 0 ? count : 1) * sizeof(struct task *));
+  if(!order){
+    perror("Failed to allocate admission check");
+    return -1;
+  }
+
+  int checked = 0;
+  int unchecked = 0;
+  for(int i = 0; i < count; i++){
+    if(tasks[i].deadline > 0 && tasks[i].runtime > 0){
+      order[checked++] = &tasks[i];
+    }else if(tasks[i].deadline > 0){
+      unchecked++;
+    }
+  }
+  qsort(order, checked, sizeof(struct task *), by_deadline);
+
+  long long demand = 0;
+  int rejected = 0;
+  for(int i = 0; i < checked; i++){
+    struct task *task = order[i];
+    // A job only ever has one core, however many the batch shares
+    if(task->runtime > task->deadline || demand + task->runtime > task->deadline * config.cores){
+      task->best_effort = 1;
+      rejected++;
+      fprintf(stderr, "Warning: job %d cannot meet its %.3fs deadline, running it best effort\n",
+        task->index + 1, task->deadline / 1e9);
+    }else{
+      demand += task->runtime;
+    }
+  }
+  if(unchecked > 0){
+    fprintf(stderr, "Warning: %d jobs with a deadline but no @runtime= were admitted unchecked\n", unchecked);
+  }
+  free(order);
+  return 0;
+}
+
+static int edf_init(struct task *tasks, int count){
+  heaps = (struct task_heap *)calloc(config.cores, sizeof(struct task_heap));
+  if(!heaps){
+    perror("Failed to allocate run queues");
+    return -1;
+  }
+  for(int i = 0; i < config.cores; i++){
+    if(heap_init(&heaps[i], count) < 0){
+      return -1;
+    }
+  }
+  return admit(tasks, count);
+}
+
+static void edf_enqueue(struct task *task){
+  task->key = (task->deadline > 0 && !task->best_effort) ? task->deadline : LLONG_MAX;
+  heap_push(&heaps[task->core], task);
+}
+
+static struct task *edf_pick_next(int core){
+  if(heaps[core].count > 0){
+    return heap_pop(&heaps[core]);
+  }
+
+  // Steal whichever other core's most urgent task is due soonest
+  int victim = -1;
+  for(int i = 0; i < config.cores; i++){
+    if(i != core && heaps[i].count > 0 &&
+       (victim < 0 || heaps[i].items[0]->key < heaps[victim].items[0]->key)){
+      victim = i;
+    }
+  }
+  if(victim < 0){
+    return NULL;
+  }
+  struct task *task = heap_pop(&heaps[victim]);
+  task->core = core;
+  return task;
+}
+
+static void edf_update(struct task *task, struct tick *tick){
+  task->slice = config.quantum;
+}
+
+static void edf_remove(struct task *task){
+  heap_remove(&heaps[task->core], task);
+}
+
+struct policy edf_policy = {
+  .name = "edf",
+  .needs_io = 0,
+  .init = edf_init,
+  .enqueue = edf_enqueue,
+  .pick_next = edf_pick_next,
+  .update = edf_update,
+  .remove = edf_remove,
+};
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sched.h"
+
+// Multi-level feedback queue. Level n runs with quantum << n. A task that
+// uses up its slice drops a level, one that blocks on its own moves up one,
+// and every boost_interval everything goes back to the top so long-running
+// jobs that change phase are not stuck at the bottom.
+
+#define MAX_LEVELS 16
+
+static struct task_queue *levels[MAX_LEVELS]; // One queue per core at each level
+static unsigned *nonempty; // Per core, bit n set while levels[n][core] has tasks
+static long long last_boost;
+static int epoch; // Bumped by each boost
+
+static int mlfq_init(struct task *tasks, int count){
+  if(config.levels < 1 || config.levels > MAX_LEVELS){
+    fprintf(stderr, "Error: MLFQ needs between 1 and %d levels\n", MAX_LEVELS);
+    return -1;
+  }
+  for(int i = 0; i < config.levels; i++){
+    levels[i] = (struct task_queue *)calloc(config.cores, sizeof(struct task_queue));
+    if(!levels[i]){
+      perror("Failed to allocate run queues");
+      return -1;
+    }
+  }
+  nonempty = (unsigned *)calloc(config.cores, sizeof(unsigned));
+  if(!nonempty){
+    perror("Failed to allocate run queues");
+    return -1;
+  }
+  for(int i = 0; i < count; i++){
+    tasks[i].level = 0;
+    tasks[i].slice = config.quantum;
+  }
+  last_boost = now_ns();
+  return 0;
+}
+
+// Tasks that were on the CPU during a boost catch up here
+static void catch_up(struct task *task){
+  if(task->epoch != epoch){
+    task->epoch = epoch;
+    task->level = 0;
+    task->slice = config.quantum;
+  }
+}
+
+static void mlfq_enqueue(struct task *task){
+  catch_up(task);
+  queue_push(&levels[task->level][task->core], task);
+  nonempty[task->core] |= 1u << task->level;
+}
+
+static void mlfq_remove(struct task *task){
+  struct task_queue *queue = task->queue;
+  queue_remove(task);
+  if(queue && queue->count == 0){
+    nonempty[task->core] &= ~(1u << task->level);
+  }
+}
+
+// Splices every lower level onto level 0. Queued tasks are reset as they
+// move, the rest when they next come off the CPU.
+static void boost(){
+  epoch++;
+  for(int core = 0; core < config.cores; core++){
+    for(int i = 1; i < config.levels; i++){
+      for(struct task *task = levels[i][core].head; task; task = task->next){
+        task->epoch = epoch;
+        task->level = 0;
+        task->slice = config.quantum;
+      }
+      queue_splice(&levels[0][core], &levels[i][core]);
+    }
+    nonempty[core] = levels[0][core].count > 0 ? 1u : 0;
+  }
+}
+
+static struct task *take(int core, int level){
+  struct task *task = queue_pop(&levels[level][core]);
+  if(levels[level][core].count == 0){
+    nonempty[core] &= ~(1u << level);
+  }
+  return task;
+}
+
+static struct task *mlfq_pick_next(int core){
+  long long now = now_ns();
+  if(now - last_boost >= config.boost_interval){
+    boost();
+    last_boost = now;
+  }
+
+  if(nonempty[core]){
+    return take(core, __builtin_ctz(nonempty[core]));
+  }
+
+  // Steal from whichever core has the highest level waiting, and of those
+  // the one with the most tasks there
+  int victim = -1;
+  int best = MAX_LEVELS;
+  for(int i = 0; i < config.cores; i++){
+    if(i == core || nonempty[i] == 0){
+      continue;
+    }
+    int level = __builtin_ctz(nonempty[i]);
+    if(level < best || (level == best && levels[level][i].count > levels[level][victim].count)){
+      victim = i;
+      best = level;
+    }
+  }
+  if(victim < 0){
+    return NULL;
+  }
+  struct task *task = take(victim, best);
+  task->core = core;
+  return task;
+}
+
+static void mlfq_update(struct task *task, struct tick *tick){
+  catch_up(task);
+
+  // Below two clock ticks the CPU delta is too coarse to say anything
+  int blocked = tick_io_bound(tick) ||
+    (task->slice >= 2 * config.tick_ns && tick->cpu_ns * 2 < task->slice);
+
+  if(blocked){
+    if(task->level > 0){
+      task->level--;
+    }
+  }else if(tick->expired && task->level < config.levels - 1){
+    task->level++;
+  }
+  task->slice = config.quantum << task->level;
+}
+
+struct policy mlfq_policy = {
+  .name = "mlfq",
+  .needs_io = 1,
+  .init = mlfq_init,
+  .enqueue = mlfq_enqueue,
+  .pick_next = mlfq_pick_next,
+  .update = mlfq_update,
+  .remove = mlfq_remove,
+};
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sched.h"
+
+// Round robin with adaptive slices: after a slice judged CPU-bound the task
+// gets twice the quantum, after one judged I/O-bound half of it.
+// tick_io_bound() judges each slice on its own block I/O delay, voluntary
+// switches and bytes moved.
+
+static struct task_queue *ready; // One FIFO per core
+
+static int rr_init(struct task *tasks, int count){
+  ready = (struct task_queue *)calloc(config.cores, sizeof(struct task_queue));
+  if(!ready){
+    perror("Failed to allocate run queues");
+    return -1;
+  }
+  return 0;
+}
+
+static void rr_enqueue(struct task *task){
+  queue_push(&ready[task->core], task);
+}
+
+static struct task *rr_pick_next(int core){
+  struct task *task = queue_pop(&ready[core]);
+  return task ? task : queue_steal(ready, core);
+}
+
+static void rr_update(struct task *task, struct tick *tick){
+  if (!tick_io_bound(tick)) {
+    task->slice = config.quantum * 2;
+  } else {
+    task->slice = (config.quantum / 2 > MIN_TIME_SLICE) ? config.quantum / 2 : MIN_TIME_SLICE;
+  }
+}
+
+struct policy rr_policy = {
+  .name = "rr",
+  .needs_io = 1,
+  .init = rr_init,
+  .enqueue = rr_enqueue,
+  .pick_next = rr_pick_next,
+  .update = rr_update,
+  .remove = queue_remove,
+};
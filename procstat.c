@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "procstat.h"
+
+#define STAT_BUFFER 1024 // Comfortably past field 42 even with a long comm
+#define LAST_FIELD 42 // delayacct_blkio_ticks
+#define STATUS_BUFFER 4096
+
+static int open_proc_file(pid_t pid, const char *name){
+  char path[40];
+  snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Re-reads the file from offset 0, falls back to a one-off open if fd is -1
+static ssize_t read_proc_file(int fd, pid_t pid, const char *name, char *buf, size_t size){
+  ssize_t len;
+
+  if(fd >= 0){
+    len = pread(fd, buf, size, 0);
+  }else{
+    int tmp = open_proc_file(pid, name);
+    if(tmp < 0){
+      return -1;
+    }
+    len = read(tmp, buf, size);
+    close(tmp);
+  }
+  return len;
+}
+
+// Kept open for the life of the child, /proc/<pid> stays the same across exec
+int open_proc_stat(pid_t pid){
+  return open_proc_file(pid, "stat");
+}
+
+int read_proc_stat(int fd, pid_t pid, struct proc_stat *stat){
+  char buf[STAT_BUFFER];
+  ssize_t len = read_proc_file(fd, pid, "stat", buf, sizeof(buf));
+  if(len <= 0){
+    return -1;
+  }
+  return parse_proc_stat(buf, len, stat);
+}
+
+// comm is free text and may hold spaces or ')', so fields are counted from
+// the last ')' in the line rather than from the start
+int parse_proc_stat(const char *buf, size_t len, struct proc_stat *stat){
+  const char *end = buf + len;
+  const char *p = memrchr(buf, ')', len);
+  if(p == NULL){
+    return -1;
+  }
+  p++;
+
+  int field = 3;
+  while(field <= LAST_FIELD){
+    while(p < end && *p == ' '){
+      p++;
+    }
+    if(p >= end){
+      return -1;
+    }
+
+    if(field == 3){
+      stat->state = *p++;
+      field++;
+      continue;
+    }
+
+    int negative = 0;
+    if(*p == '-'){
+      negative = 1;
+      p++;
+    }
+    unsigned long long value = 0;
+    while(p < end && *p >= '0' && *p <= '9'){
+      value = value * 10 + (*p++ - '0');
+    }
+
+    switch(field){
+      case 14:
+        stat->utime = value;
+        break;
+      case 15:
+        stat->stime = value;
+        break;
+      case 19:
+        stat->nice = negative ? -(long)value : (long)value;
+        break;
+      case 22:
+        stat->starttime = value;
+        break;
+      case 23:
+        stat->vsize = value;
+        break;
+      case 24:
+        stat->rss = negative ? -(long)value : (long)value;
+        break;
+      case 42:
+        stat->blkio_ticks = value;
+        break;
+    }
+
+    while(p < end && *p != ' '){
+      p++;
+    }
+    field++;
+  }
+  return 0;
+}
+
+int open_proc_status(pid_t pid){
+  return open_proc_file(pid, "status");
+}
+
+static long parse_status_value(const char *p, const char *end){
+  long value = 0;
+  while(p < end && (*p == ' ' || *p == '\t')){
+    p++;
+  }
+  while(p < end && *p >= '0' && *p <= '9'){
+    value = value * 10 + (*p++ - '0');
+  }
+  return value;
+}
+
+// Only the two *_ctxt_switches lines are wanted, matched at line starts
+int read_proc_status(int fd, pid_t pid, struct proc_status *status){
+  static const char voluntary[] = "voluntary_ctxt_switches:";
+  static const char involuntary[] = "nonvoluntary_ctxt_switches:";
+  char buf[STATUS_BUFFER];
+  ssize_t len = read_proc_file(fd, pid, "status", buf, sizeof(buf));
+  if(len <= 0){
+    return -1;
+  }
+
+  const char *end = buf + len;
+  const char *line = buf;
+  int found = 0;
+  while(line < end && found < 2){
+    size_t left = end - line;
+    if(left > sizeof(voluntary) && memcmp(line, voluntary, sizeof(voluntary) - 1) == 0){
+      status->voluntary = parse_status_value(line + sizeof(voluntary) - 1, end);
+      found++;
+    }else if(left > sizeof(involuntary) && memcmp(line, involuntary, sizeof(involuntary) - 1) == 0){
+      status->involuntary = parse_status_value(line + sizeof(involuntary) - 1, end);
+      found++;
+    }
+    const char *next = memchr(line, '\n', left);
+    if(next == NULL){
+      break;
+    }
+    line = next + 1;
+  }
+  return found == 2 ? 0 : -1;
+}
+
+int open_proc_io(pid_t pid){
+  return open_proc_file(pid, "io");
+}
+
+int read_proc_io(int fd, pid_t pid, struct proc_io *io){
+  static const char *names[] = {"rchar:", "wchar:", "read_bytes:", "write_bytes:"};
+  unsigned long long *values[] = {&io->rchar, &io->wchar, &io->read_bytes, &io->write_bytes};
+  char buf[STATUS_BUFFER];
+  ssize_t len = read_proc_file(fd, pid, "io", buf, sizeof(buf));
+  if(len <= 0){
+    return -1;
+  }
+
+  const char *end = buf + len;
+  const char *line = buf;
+  int found = 0;
+  while(line < end){
+    size_t left = end - line;
+    for(int i = 0; i < 4; i++){
+      size_t name_len = strlen(names[i]);
+      if(left > name_len && memcmp(line, names[i], name_len) == 0){
+        *values[i] = parse_status_value(line + name_len, end);
+        found++;
+      }
+    }
+    const char *next = memchr(line, '\n', left);
+    if(next == NULL){
+      break;
+    }
+    line = next + 1;
+  }
+  return found == 4 ? 0 : -1;
+}
+
+// Off by default since 5.14, blkio ticks then stay at 0
+int delayacct_enabled(){
+  char value = '0';
+  int fd = open("/proc/sys/kernel/task_delayacct", O_RDONLY | O_CLOEXEC);
+  if(fd >= 0){
+    read(fd, &value, 1);
+    close(fd);
+  }
+  return value == '1';
+}
+
+// -1 when the kernel has no PSI support, callers then go by RSS alone
+int open_memory_pressure(){
+  return open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+}
+
+// The "some avg10" figure: the share of the last 10s in which at least one
+// task was stalled on memory, in percent
+int read_memory_pressure(int fd, double *some_avg10){
+  char buf[256];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if(len <= 0){
+    return -1;
+  }
+  buf[len] = '\0';
+  const char *p = strstr(buf, "some avg10=");
+  if(p == NULL){
+    return -1;
+  }
+  p += 11;
+
+  double value = 0;
+  while(*p >= '0' && *p <= '9'){
+    value = value * 10 + (*p++ - '0');
+  }
+  if(*p == '.'){
+    double scale = 0.1;
+    for(p++; *p >= '0' && *p <= '9'; p++){
+      value += (*p - '0') * scale;
+      scale /= 10;
+    }
+  }
+  *some_avg10 = value;
+  return 0;
+}
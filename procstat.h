@@ -0,0 +1,45 @@
+#ifndef PROCSTAT_H
+#define PROCSTAT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// The /proc/<pid>/stat fields the scheduler uses, times are in clock ticks
+struct proc_stat {
+  char state;
+  unsigned long utime;
+  unsigned long stime;
+  long nice;
+  unsigned long long starttime;
+  unsigned long vsize;
+  long rss; // Resident pages, the same figure statm reports
+  unsigned long long blkio_ticks; // Waiting on block I/O, 0 unless delay accounting is on
+};
+
+// Byte counters from /proc/<pid>/io. rchar and wchar count every read and
+// write call, pipes and /dev/null included, the other two only storage.
+struct proc_io {
+  unsigned long long rchar;
+  unsigned long long wchar;
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+};
+
+// Context switch counts from /proc/<pid>/status
+struct proc_status {
+  long voluntary;
+  long involuntary;
+};
+
+int open_proc_stat(pid_t pid);
+int read_proc_stat(int fd, pid_t pid, struct proc_stat *stat);
+int parse_proc_stat(const char *buf, size_t len, struct proc_stat *stat);
+int open_proc_status(pid_t pid);
+int read_proc_status(int fd, pid_t pid, struct proc_status *status);
+int open_proc_io(pid_t pid);
+int read_proc_io(int fd, pid_t pid, struct proc_io *io);
+int delayacct_enabled();
+int open_memory_pressure();
+int read_memory_pressure(int fd, double *some_avg10);
+
+#endif
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "report.h"
+
+#define REPORT_BUFFER (1 << 20) // Per buffer, about 12k table rows
+#define ROW_MAX 256 // Longest row any format writes
+
+static int format;
+static char *buffers[2];
+static size_t length; // Of the buffer being filled
+static int filling; // Which buffer the scheduler writes into
+static int rows_left_out; // Rows of this report that did not fit
+static long long reports_skipped; // Writer was still busy with the last one
+static long long rows_truncated;
+static int header_done;
+static double elapsed; // Of the report being filled, in seconds
+static double ticks_per_sec;
+static long page_size;
+
+static _Atomic int pending; // A buffer is handed to the writer
+static size_t pending_length;
+static char *pending_buffer;
+static _Atomic int stopping;
+static int wake_fd = -1;
+static pthread_t writer;
+
+int parse_report_format(const char *name){
+  if(strcmp(name, "table") == 0){
+    return REPORT_TABLE;
+  }else if(strcmp(name, "csv") == 0){
+    return REPORT_CSV;
+  }else if(strcmp(name, "json") == 0){
+    return REPORT_JSON;
+  }
+  return -1;
+}
+
+// Writes a whole report even if stdout takes it a piece at a time
+static void write_all(const char *buf, size_t len){
+  while(len > 0){
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+static void *writer_main(void *arg){
+  struct pollfd pfd = {.fd = wake_fd, .events = POLLIN};
+  uint64_t kicks;
+
+  for(;;){
+    if(atomic_load_explicit(&pending, memory_order_acquire)){
+      write_all(pending_buffer, pending_length);
+      atomic_store_explicit(&pending, 0, memory_order_release);
+    }else if(atomic_load_explicit(&stopping, memory_order_acquire)){
+      return NULL;
+    }
+    if(poll(&pfd, 1, -1) > 0){
+      read(wake_fd, &kicks, sizeof(kicks));
+    }
+  }
+}
+
+int report_open(int report_format){
+  format = report_format;
+  ticks_per_sec = sysconf(_SC_CLK_TCK);
+  page_size = sysconf(_SC_PAGESIZE);
+  buffers[0] = (char *)malloc(REPORT_BUFFER);
+  buffers[1] = (char *)malloc(REPORT_BUFFER);
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(!buffers[0] || !buffers[1] || wake_fd < 0){
+    perror("Failed to set up the reporter");
+    return -1;
+  }
+  if(pthread_create(&writer, NULL, writer_main, NULL) != 0){
+    fprintf(stderr, "Error: failed to start the reporter\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void append(const char *text, int len){
+  memcpy(buffers[filling] + length, text, len);
+  length += len;
+}
+
+void report_begin(long long elapsed_ns){
+  char line[ROW_MAX];
+  int len = 0;
+
+  length = 0;
+  rows_left_out = 0;
+  if(format == REPORT_TABLE){
+    len = snprintf(line, sizeof(line), "\nPID\tutime\tstime\ttime\tnice\tvirt mem\tres mem\n");
+  }else if(format == REPORT_CSV && !header_done){
+    len = snprintf(line, sizeof(line), "elapsed_s,pid,utime_s,stime_s,cpu_s,nice,vsize,rss\n");
+    header_done = 1;
+  }
+  append(line, len);
+  elapsed = elapsed_ns / 1e9;
+}
+
+// CPU time is the source's own figure, to the ns under -S perf, while the
+// user and system split only ever comes in clock ticks
+void report_row(pid_t pid, const struct task_stats *stats){
+  char line[ROW_MAX];
+  const struct proc_stat *stat = &stats->stat;
+  double utime = stat->utime / ticks_per_sec;
+  double stime = stat->stime / ticks_per_sec;
+  double cpu = stats->cpu_ns / 1e9;
+  long rss = stat->rss * page_size;
+  int len;
+
+  switch(format){
+    case REPORT_CSV:
+      len = snprintf(line, sizeof(line), "%.3f,%d,%.6f,%.6f,%.6f,%ld,%lu,%ld\n",
+        elapsed, pid, utime, stime, cpu, stat->nice, stat->vsize, rss);
+      break;
+    case REPORT_JSON:
+      len = snprintf(line, sizeof(line),
+        "{\"elapsed_s\": %.3f, \"pid\": %d, \"utime_s\": %.6f, \"stime_s\": %.6f, \"cpu_s\": %.9f, \"nice\": %ld, \"vsize\": %lu, \"rss\": %ld",
+        elapsed, pid, utime, stime, cpu, stat->nice, stat->vsize, rss);
+      if(stats->counted && len < (int)sizeof(line)){
+        len += snprintf(line + len, sizeof(line) - len,
+          ", \"context_switches\": %lld, \"page_faults\": %lld, \"migrations\": %lld",
+          stats->context_switches, stats->page_faults, stats->migrations);
+      }
+      if(len < (int)sizeof(line)){
+        len += snprintf(line + len, sizeof(line) - len, "}\n");
+      }
+      break;
+    default:
+      len = snprintf(line, sizeof(line), "%d - %0.6f %0.6f %0.6f    %ld  %lu  %ld\n",
+        pid, utime, stime, cpu, stat->nice, stat->vsize, rss);
+  }
+
+  // Room is kept for the table's closing line
+  if(len >= (int)sizeof(line) || length + len + ROW_MAX > REPORT_BUFFER){
+    rows_left_out++;
+    return;
+  }
+  append(line, len);
+}
+
+// Hands the report over unless the writer is still on the previous one, in
+// which case it is dropped rather than waited for
+void report_end(){
+  if(rows_left_out > 0){
+    rows_truncated += rows_left_out;
+    if(format == REPORT_TABLE){
+      char line[ROW_MAX];
+      append(line, snprintf(line, sizeof(line), "... and %d more\n", rows_left_out));
+    }
+  }
+  if(atomic_load_explicit(&pending, memory_order_acquire)){
+    reports_skipped++;
+    return;
+  }
+
+  uint64_t one = 1;
+  pending_buffer = buffers[filling];
+  pending_length = length;
+  atomic_store_explicit(&pending, 1, memory_order_release);
+  write(wake_fd, &one, sizeof(one));
+  filling ^= 1;
+}
+
+// Lets the last report out before the closing summary
+void report_close(){
+  if(wake_fd < 0){
+    return;
+  }
+
+  uint64_t one = 1;
+  atomic_store_explicit(&stopping, 1, memory_order_release);
+  write(wake_fd, &one, sizeof(one));
+  pthread_join(writer, NULL);
+
+  if(reports_skipped > 0){
+    fprintf(stderr, "Warning: %lld reports skipped, stdout could not keep up\n", reports_skipped);
+  }
+  if(rows_truncated > 0){
+    fprintf(stderr, "Warning: %lld report rows did not fit the report buffer\n", rows_truncated);
+  }
+  close(wake_fd);
+  free(buffers[0]);
+  free(buffers[1]);
+}
@@ -0,0 +1,25 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <sys/types.h>
+
+#include "stats.h"
+
+// The periodic process table. The scheduler formats each report into one of
+// two preallocated buffers and a background thread writes it out, so a slow
+// terminal or a full pipe only ever costs reports, never a dispatch.
+
+enum report_format {
+  REPORT_TABLE, // The original human table
+  REPORT_CSV, // One row per job per report, header once
+  REPORT_JSON, // One JSON object per job per report
+};
+
+int parse_report_format(const char *name);
+int report_open(int format);
+void report_begin(long long elapsed_ns);
+void report_row(pid_t pid, const struct task_stats *stats);
+void report_end();
+void report_close();
+
+#endif
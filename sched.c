@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sched.h"
+
+struct sched_config config = {
+  .quantum = TIME_SLICE,
+  .levels = 3,
+  .boost_interval = 5000000000LL,
+  .tick_ns = 10000000LL,
+  .cores = 1,
+};
+
+struct policy *policies[] = {&rr_policy, &mlfq_policy, &cfs_policy, &edf_policy, &cpath_policy, NULL};
+
+static struct task **task_map; // Open addressing, at most half full
+static unsigned task_map_mask;
+
+long long now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Whether a slice was spent mostly waiting on I/O rather than computing.
+// A slice cut short because the job fell asleep is, by definition. Otherwise
+// any one of these will do: a quarter of the CPU time again spent in block
+// I/O delay, more voluntary than involuntary switches beyond our own SIGSTOP,
+// or a byte rate per CPU ms that only a job shifting data would reach. The
+// last one catches writers to pipes or /dev/null, which never block and
+// would otherwise look like pure user time.
+int tick_io_bound(struct tick *tick){
+  if(tick->blocked){
+    return 1;
+  }
+  if(tick->blkio_ns * 4 > tick->cpu_ns && tick->blkio_ns > 0){
+    return 1;
+  }
+  if(tick->voluntary > 1 && tick->voluntary - 1 > tick->involuntary){
+    return 1;
+  }
+  return tick->io_bytes > (tick->cpu_ns / 1000000 + 1) * IO_BYTES_PER_CPU_MS;
+}
+
+void queue_push(struct task_queue *queue, struct task *task){
+  task->queue = queue;
+  task->next = NULL;
+  task->prev = queue->tail;
+  if(queue->tail){
+    queue->tail->next = task;
+  }else{
+    queue->head = task;
+  }
+  queue->tail = task;
+  queue->count++;
+}
+
+struct task *queue_pop(struct task_queue *queue){
+  struct task *task = queue->head;
+  if(task){
+    queue_remove(task);
+  }
+  return task;
+}
+
+void queue_remove(struct task *task){
+  struct task_queue *queue = task->queue;
+  if(queue == NULL){
+    return;
+  }
+  if(task->prev){
+    task->prev->next = task->next;
+  }else{
+    queue->head = task->next;
+  }
+  if(task->next){
+    task->next->prev = task->prev;
+  }else{
+    queue->tail = task->prev;
+  }
+  queue->count--;
+  task->queue = NULL;
+  task->prev = task->next = NULL;
+}
+
+// Moves everything in from onto the end of to, only the moved tasks'
+// queue pointers need touching
+void queue_splice(struct task_queue *to, struct task_queue *from){
+  if(from->head == NULL){
+    return;
+  }
+  for(struct task *task = from->head; task; task = task->next){
+    task->queue = to;
+  }
+  if(to->tail){
+    to->tail->next = from->head;
+    from->head->prev = to->tail;
+  }else{
+    to->head = from->head;
+  }
+  to->tail = from->tail;
+  to->count += from->count;
+  from->head = from->tail = NULL;
+  from->count = 0;
+}
+
+// Takes the oldest task from the longest of the other cores' queues,
+// queues[] holding one queue per core
+struct task *queue_steal(struct task_queue *queues, int core){
+  int victim = -1;
+  for(int i = 0; i < config.cores; i++){
+    if(i != core && queues[i].count > 0 && (victim < 0 || queues[i].count > queues[victim].count)){
+      victim = i;
+    }
+  }
+  if(victim < 0){
+    return NULL;
+  }
+  struct task *task = queue_pop(&queues[victim]);
+  task->core = core;
+  return task;
+}
+
+int heap_init(struct task_heap *heap, int capacity){
+  heap->items = (struct task **)malloc((capacity > 0 ? capacity : 1) * sizeof(struct task *));
+  heap->count = 0;
+  if(!heap->items){
+    perror("Failed to allocate run queue");
+    return -1;
+  }
+  return 0;
+}
+
+static int before(struct task *a, struct task *b){
+  return a->key < b->key || (a->key == b->key && a->index < b->index);
+}
+
+static void place(struct task_heap *heap, int index, struct task *task){
+  heap->items[index] = task;
+  task->heap_index = index;
+}
+
+static void sift_up(struct task_heap *heap, int index){
+  struct task *task = heap->items[index];
+  while(index > 0){
+    int parent = (index - 1) / 2;
+    if(!before(task, heap->items[parent])){
+      break;
+    }
+    place(heap, index, heap->items[parent]);
+    index = parent;
+  }
+  place(heap, index, task);
+}
+
+static void sift_down(struct task_heap *heap, int index){
+  struct task *task = heap->items[index];
+  while(1){
+    int child = index * 2 + 1;
+    if(child >= heap->count){
+      break;
+    }
+    if(child + 1 < heap->count && before(heap->items[child + 1], heap->items[child])){
+      child++;
+    }
+    if(!before(heap->items[child], task)){
+      break;
+    }
+    place(heap, index, heap->items[child]);
+    index = child;
+  }
+  place(heap, index, task);
+}
+
+void heap_push(struct task_heap *heap, struct task *task){
+  place(heap, heap->count++, task);
+  sift_up(heap, task->heap_index);
+}
+
+struct task *heap_pop(struct task_heap *heap){
+  if(heap->count == 0){
+    return NULL;
+  }
+  struct task *task = heap->items[0];
+  heap_remove(heap, task);
+  return task;
+}
+
+void heap_remove(struct task_heap *heap, struct task *task){
+  int index = task->heap_index;
+  if(index < 0){
+    return;
+  }
+  struct task *last = heap->items[--heap->count];
+  task->heap_index = -1;
+  if(last != task){
+    place(heap, index, last);
+    sift_down(heap, index);
+    sift_up(heap, last->heap_index);
+  }
+}
+
+int task_map_init(int count){
+  unsigned size = 16;
+  while(size < (unsigned)count * 2){
+    size <<= 1;
+  }
+  task_map = (struct task **)calloc(size, sizeof(struct task *));
+  if(!task_map){
+    perror("Failed to allocate pid map");
+    return -1;
+  }
+  task_map_mask = size - 1;
+  return 0;
+}
+
+void task_map_add(struct task *task){
+  unsigned slot = (unsigned)task->pid * 2654435761u;
+  while(task_map[slot & task_map_mask]){
+    slot++;
+  }
+  task_map[slot & task_map_mask] = task;
+}
+
+struct task *task_map_find(pid_t pid){
+  unsigned slot = (unsigned)pid * 2654435761u;
+  struct task *task;
+  while((task = task_map[slot & task_map_mask]) != NULL){
+    if(task->pid == pid && !task->completed){ // pids are reused over a long batch
+      return task;
+    }
+    slot++;
+  }
+  return NULL;
+}
@@ -0,0 +1,142 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <sys/types.h>
+
+#include "procstat.h"
+#include "stats.h"
+
+#define TIME_SLICE 1000000000LL // Default time quantum in ns
+#define MIN_TIME_SLICE 500000LL // Minimum allowed time quantum (500 us)
+#define IO_BYTES_PER_CPU_MS 65536 // Syscall I/O rate that marks a slice as I/O bound
+
+// One launched job as the scheduler sees it
+struct task_queue;
+
+struct task {
+  struct task *prev; // Links on the run queue it is waiting on
+  struct task *next;
+  struct task_queue *queue; // NULL while running or once it has exited
+  int index; // Line order in the batch file
+  int slot; // Launcher stack slot, free again once it exits
+  pid_t pid;
+  int pidfd; // Exit notification, -1 if pidfd_open is unavailable
+  int stat_fd; // Open /proc/<pid>/stat, -1 means open it per read
+  int status_fd; // Open /proc/<pid>/status, same fallback
+  int io_fd; // Open /proc/<pid>/io, same fallback
+  int control_fd; // cgroup.freeze or cpu.max under the cgroup backend
+  int stats_fd; // cpu.stat of its cgroup, or the perf source's group leader
+  int perf_fds[PERF_COUNTERS - 1]; // The rest of the perf source's counter group
+  int out_fd; // Read end of its output pipe when capturing, else -1
+  int out_write; // Write end, the job's stdout and stderr
+  int out_file; // Its own file under --output-dir, -1 with --output-log
+  long long out_bytes;
+  int completed;
+  int adopted; // Re-attached from a --state file, not our child
+  long long slice; // Quantum for its next dispatch, in ns
+  int level; // MLFQ priority, 0 is the highest
+  int epoch; // MLFQ boost its level dates from
+  int nice; // From @nice= in the batch file
+  long long vruntime; // CFS virtual runtime in ns, CPU time scaled by 1024 / weight
+  long long deadline; // From @deadline=, ns after the batch starts, 0 if none
+  long long runtime; // Expected CPU ns from @runtime=, 0 if unknown
+  int best_effort; // EDF admission could not fit its deadline
+  long long key; // What its task_heap is ordered by
+  int heap_index; // Position in its task_heap, -1 when not in one
+  int core; // Run queue it waits on
+  int cpu; // CPU it is pinned to, -1 until first dispatched under -j
+  long long last_cpu_ns; // utime + stime when it last came off the CPU
+  struct proc_status last_switches;
+  long long last_blkio_ns;
+  struct proc_io last_io;
+  long long rss; // Resident bytes when it last came off the CPU, 0 until then
+  long long block_cpu_ns; // CPU time at the last --block-check look
+  int asleep; // Was sleeping at that look as well
+  long long launched_ns; // Timestamps for -r, first_run_ns is 0 until dispatched
+  long long first_run_ns;
+  long long exited_ns;
+  int status; // Wait status once exited, -1 if adopted, -2 if skipped after a failed dependency
+  int waiting_on; // @after= jobs that have not finished yet
+  int *dependents; // Jobs with this one in their @after=
+  int num_dependents;
+  long long path_ns; // Expected runtime of this job and the longest chain waiting on it
+};
+
+// What a task did during the slice it just finished
+struct tick {
+  int expired; // Ran until the timer fired rather than exiting
+  int blocked; // Taken off early because it had gone to sleep
+  struct proc_stat stat; // Cumulative, as of now
+  long long cpu_ns; // CPU time used this slice
+  long voluntary; // Context switches this slice, including our SIGSTOP
+  long involuntary;
+  long long blkio_ns; // Waiting on block I/O this slice
+  long long io_bytes; // Read and written through syscalls this slice, any file
+};
+
+// A scheduling policy. update() sees every task coming off the CPU before
+// it is queued again on task->core, pick_next() removes and returns the next
+// task for a core, stealing from the other cores once its own queue is empty.
+// remove() takes out a queued task that has exited. None of them may cost
+// more as the number of finished jobs grows.
+struct policy {
+  const char *name;
+  int needs_io; // Whether update() wants switches, I/O delay and byte counts sampled
+  int (*init)(struct task *tasks, int count);
+  void (*enqueue)(struct task *task);
+  struct task *(*pick_next)(int core);
+  void (*update)(struct task *task, struct tick *tick);
+  void (*remove)(struct task *task);
+};
+
+struct sched_config {
+  long long quantum; // Base quantum, set with -q
+  int levels; // MLFQ levels, set with -l
+  long long boost_interval; // MLFQ priority boost period, set with -b
+  long long tick_ns; // One _SC_CLK_TCK tick, the resolution of utime/stime
+  int cores; // Jobs running at once, set with -j
+};
+
+extern struct sched_config config;
+extern struct policy rr_policy;
+extern struct policy mlfq_policy;
+extern struct policy cfs_policy;
+extern struct policy edf_policy;
+extern struct policy cpath_policy;
+extern struct policy *policies[]; // NULL terminated, for -p
+
+// A FIFO threaded through the tasks themselves, so every operation is O(1)
+// and an exited task can be unlinked from wherever it waits
+struct task_queue {
+  struct task *head;
+  struct task *tail;
+  int count;
+};
+
+void queue_push(struct task_queue *queue, struct task *task);
+struct task *queue_pop(struct task_queue *queue);
+void queue_remove(struct task *task);
+void queue_splice(struct task_queue *to, struct task_queue *from);
+struct task *queue_steal(struct task_queue *queues, int core);
+
+// A binary min-heap on task->key, ties going to the earlier line. Tasks
+// remember their position so any of them can be removed in O(log n).
+struct task_heap {
+  struct task **items;
+  int count;
+};
+
+int heap_init(struct task_heap *heap, int capacity);
+void heap_push(struct task_heap *heap, struct task *task);
+struct task *heap_pop(struct task_heap *heap);
+void heap_remove(struct task_heap *heap, struct task *task);
+
+// pid -> task, for the reaper
+int task_map_init(int count);
+void task_map_add(struct task *task);
+struct task *task_map_find(pid_t pid);
+
+long long now_ns();
+int tick_io_bound(struct tick *tick);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Generates a batch file mixing cpubound, iobound and sleep jobs, runs it
+// under each part5 policy and prints turnaround, response and overhead
+// figures as JSON on stdout. part5 writes its raw per-job times with -r.
+
+#define MAX_POLICIES 8
+#define MAX_PASSTHROUGH 8
+
+const char *policies[MAX_POLICIES] = {"rr", "mlfq", "cfs", "edf"};
+int num_policies = 4;
+
+struct result {
+  char policy[32];
+  long long makespan;
+  long long switches;
+  long long sched_cpu;
+  long long *turnaround;
+  long long *response;
+  int jobs;
+  int responded; // Jobs that were dispatched at least once
+};
+
+int compare_ll(const void *a, const void *b){
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+double mean(long long *values, int count){
+  double sum = 0;
+  for(int i = 0; i < count; i++){
+    sum += values[i];
+  }
+  return count > 0 ? sum / count : 0;
+}
+
+// Nearest-rank percentile, values must already be sorted
+long long percentile(long long *values, int count, int p){
+  if(count == 0){
+    return 0;
+  }
+  int rank = (count * p + 99) / 100;
+  return values[rank > 0 ? rank - 1 : 0];
+}
+
+int write_manifest(const char *path, int count, int cpu_pct, int io_pct, int seconds, unsigned seed){
+  FILE *file = fopen(path, "w");
+  if(!file){
+    perror("Failed to create manifest");
+    return -1;
+  }
+  srand(seed);
+  for(int i = 0; i < count; i++){
+    int roll = rand() % 100;
+    if(roll < cpu_pct){
+      fprintf(file, "./cpubound -seconds %d\n", seconds);
+    }else if(roll < cpu_pct + io_pct){
+      fprintf(file, "./iobound -seconds %d\n", seconds);
+    }else{
+      fprintf(file, "sleep %d\n", seconds);
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+int run_part5(const char *manifest, const char *policy, const char *results, char **extra, int num_extra){
+  char *args[16 + MAX_PASSTHROUGH];
+  int n = 0;
+  args[n++] = "./part5";
+  args[n++] = "-f";
+  args[n++] = (char *)manifest;
+  args[n++] = "-p";
+  args[n++] = (char *)policy;
+  args[n++] = "-r";
+  args[n++] = (char *)results;
+  for(int i = 0; i < num_extra; i++){
+    args[n++] = extra[i];
+  }
+  args[n] = NULL;
+
+  pid_t pid = fork();
+  if(pid < 0){
+    perror("Failed to fork part5");
+    return -1;
+  }
+  if(pid == 0){
+    // Keep the jobs' chatter off the JSON
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    execv(args[0], args);
+    perror("Execv failed: ./part5");
+    _exit(EXIT_FAILURE);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+    fprintf(stderr, "Error: part5 -p %s failed\n", policy);
+    return -1;
+  }
+  return 0;
+}
+
+int read_results(const char *path, struct result *result, int count){
+  FILE *file = fopen(path, "r");
+  if(!file){
+    perror("Failed to open part5 results");
+    return -1;
+  }
+
+  result->turnaround = (long long *)malloc(count * sizeof(long long));
+  result->response = (long long *)malloc(count * sizeof(long long));
+  if(!result->turnaround || !result->response){
+    perror("Failed to allocate results");
+    fclose(file);
+    return -1;
+  }
+  result->jobs = 0;
+  result->responded = 0;
+
+  char line[256];
+  while(fgets(line, sizeof(line), file)){
+    int index;
+    long long launched, first_run, exited;
+    if(sscanf(line, "job %d %lld %lld %lld", &index, &launched, &first_run, &exited) == 4){
+      if(result->jobs < count){
+        result->turnaround[result->jobs++] = exited - launched;
+        if(first_run >= 0){
+          result->response[result->responded++] = first_run - launched;
+        }
+      }
+    }else{
+      sscanf(line, "policy %31s", result->policy);
+      sscanf(line, "makespan_ns %lld", &result->makespan);
+      sscanf(line, "switches %lld", &result->switches);
+      sscanf(line, "sched_cpu_ns %lld", &result->sched_cpu);
+    }
+  }
+  fclose(file);
+
+  qsort(result->turnaround, result->jobs, sizeof(long long), compare_ll);
+  qsort(result->response, result->responded, sizeof(long long), compare_ll);
+  return 0;
+}
+
+void print_result(struct result *result, int last){
+  double makespan = result->makespan / 1e9;
+  printf("    {\"policy\": \"%s\", \"jobs\": %d, \"makespan_s\": %.6f,\n", result->policy, result->jobs, makespan);
+  printf("     \"turnaround_mean_s\": %.6f, \"turnaround_p99_s\": %.6f,\n",
+    mean(result->turnaround, result->jobs) / 1e9, percentile(result->turnaround, result->jobs, 99) / 1e9);
+  printf("     \"response_mean_s\": %.6f, \"response_p99_s\": %.6f,\n",
+    mean(result->response, result->responded) / 1e9, percentile(result->response, result->responded, 99) / 1e9);
+  printf("     \"switches\": %lld, \"switches_per_s\": %.2f,\n",
+    result->switches, makespan > 0 ? result->switches / makespan : 0);
+  printf("     \"sched_cpu_s\": %.6f, \"sched_cpu_pct\": %.3f}%s\n",
+    result->sched_cpu / 1e9, makespan > 0 ? 100.0 * result->sched_cpu / result->makespan : 0, last ? "" : ",");
+}
+
+int main(int argc, char *argv[]){
+  int count = 12;
+  int cpu_pct = 40;
+  int io_pct = 30;
+  int seconds = 1;
+  unsigned seed = 1;
+  const char *keep = NULL;
+  char *extra[MAX_PASSTHROUGH];
+  int num_extra = 0;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:c:i:d:S:o:P:q:j:")) != -1){
+    switch(opt){
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'c':
+        cpu_pct = atoi(optarg);
+        break;
+      case 'i':
+        io_pct = atoi(optarg);
+        break;
+      case 'd':
+        seconds = atoi(optarg);
+        break;
+      case 'S':
+        seed = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'o':
+        keep = optarg;
+        break;
+      case 'P':
+        // Comma separated, replaces the default list
+        num_policies = 0;
+        for(char *name = strtok(optarg, ","); name && num_policies < MAX_POLICIES; name = strtok(NULL, ",")){
+          policies[num_policies++] = name;
+        }
+        break;
+      case 'q':
+      case 'j':
+        if(num_extra + 2 > MAX_PASSTHROUGH){
+          break;
+        }
+        extra[num_extra++] = opt == 'q' ? "-q" : "-j";
+        extra[num_extra++] = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n jobs] [-c cpu%%] [-i io%%] [-d seconds] [-S seed] [-o manifest] [-P policies] [-q quantum] [-j cores]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if(count < 1 || seconds < 1 || cpu_pct < 0 || io_pct < 0 || cpu_pct + io_pct > 100 || num_policies == 0){
+    fprintf(stderr, "Error: need at least one job, one policy, a duration and ratios adding up to at most 100%%\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char manifest[64];
+  char results[64];
+  snprintf(manifest, sizeof(manifest), "/tmp/schedbench.%d.txt", getpid());
+  snprintf(results, sizeof(results), "/tmp/schedbench.%d.out", getpid());
+  if(keep){
+    snprintf(manifest, sizeof(manifest), "%s", keep);
+  }
+  if(write_manifest(manifest, count, cpu_pct, io_pct, seconds, seed) < 0){
+    exit(EXIT_FAILURE);
+  }
+
+  printf("{\n  \"jobs\": %d, \"cpu_pct\": %d, \"io_pct\": %d, \"sleep_pct\": %d, \"seconds\": %d, \"seed\": %u,\n",
+    count, cpu_pct, io_pct, 100 - cpu_pct - io_pct, seconds, seed);
+  printf("  \"results\": [\n");
+
+  int failed = 0;
+  for(int i = 0; i < num_policies; i++){
+    struct result result;
+    memset(&result, 0, sizeof(result));
+    if(run_part5(manifest, policies[i], results, extra, num_extra) < 0 ||
+       read_results(results, &result, count) < 0){
+      failed = 1;
+      break;
+    }
+    print_result(&result, i == num_policies - 1);
+    fflush(stdout);
+    free(result.turnaround);
+    free(result.response);
+  }
+  printf("  ]\n}\n");
+
+  unlink(results);
+  if(!keep){
+    unlink(manifest);
+  }
+  return failed ? EXIT_FAILURE : 0;
+}
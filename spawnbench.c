@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "jobs.h"
+#include "launch.h"
+
+// Times how long each launcher takes to get a batch of jobs held and stopped
+// (the part the scheduler waits on before its first dispatch), then lets them
+// run to completion. -m pads our heap to mimic a larger scheduler process.
+
+long long now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Returns the startup time in ns, or -1 if a launch failed
+long long run_batch(struct job_table *table, int fast){
+  pid_t *pids = (pid_t *)malloc(table->count * sizeof(pid_t));
+  if(!pids){
+    perror("Failed to allocate memory for pid array");
+    exit(EXIT_FAILURE);
+  }
+
+  long long start = now_ns();
+  struct launcher launcher;
+  if(launcher_init(&launcher, fast, table->count) < 0){
+    exit(EXIT_FAILURE);
+  }
+
+  int launched = 0;
+  for(int i = 0; i < table->count; i++){
+    pids[i] = launch_job(&launcher, &table->jobs[i], i, -1);
+    if(pids[i] < 0){
+      perror("Failed to fork process");
+      break;
+    }
+    launched++;
+  }
+  launcher_release(&launcher, pids, launched);
+  long long elapsed = now_ns() - start;
+
+  for(int i = 0; i < launched; i++){
+    kill(pids[i], SIGCONT);
+  }
+  for(int i = 0; i < launched; i++){
+    waitpid(pids[i], NULL, 0);
+  }
+
+  sigprocmask(SIG_SETMASK, &launcher.old_mask, NULL);
+  launcher_destroy(&launcher);
+  free(pids);
+  return launched == table->count ? elapsed : -1;
+}
+
+int write_manifest(const char *filename, int count){
+  FILE *file = fopen(filename, "w");
+  if(!file){
+    perror("Error opening file");
+    return -1;
+  }
+  for(int i = 0; i < count; i++){
+    fprintf(file, "true\n");
+  }
+  fclose(file);
+  return 0;
+}
+
+int main(int argc, char *argv[]){
+  int counts[] = {100, 1000, 10000};
+  int num_counts = sizeof(counts) / sizeof(counts[0]);
+  long pad_mb = 0;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:m:")) != -1){
+    switch(opt){
+      case 'n':
+        counts[0] = atoi(optarg);
+        num_counts = 1;
+        break;
+      case 'm':
+        pad_mb = atol(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n jobs] [-m heap MB]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  char *pad = NULL;
+  if(pad_mb > 0){
+    pad = (char *)malloc(pad_mb << 20);
+    if(!pad){
+      perror("Failed to allocate heap padding");
+      exit(EXIT_FAILURE);
+    }
+    memset(pad, 1, pad_mb << 20); // Touched so fork has page tables to copy
+  }
+
+  char filename[] = "/tmp/spawnbench-XXXXXX";
+  int fd = mkstemp(filename);
+  if(fd < 0){
+    perror("Failed to create manifest");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  printf("jobs\tfork(ms)\tfast(ms)\tfork/job(us)\tfast/job(us)\n");
+  for(int i = 0; i < num_counts; i++){
+    struct job_table table;
+    if(write_manifest(filename, counts[i]) < 0 || load_job_file(filename, &table) < 0){
+      unlink(filename);
+      exit(EXIT_FAILURE);
+    }
+
+    long long fork_ns = run_batch(&table, 0);
+    long long fast_ns = run_batch(&table, 1);
+    if(fork_ns < 0 || fast_ns < 0){
+      fprintf(stderr, "Could not launch %d jobs\n", counts[i]);
+    }else{
+      printf("%d\t%0.3f\t\t%0.3f\t\t%0.2f\t\t%0.2f\n", counts[i],
+        fork_ns / 1e6, fast_ns / 1e6,
+        fork_ns / 1e3 / counts[i], fast_ns / 1e3 / counts[i]);
+    }
+    free_job_table(&table);
+  }
+
+  unlink(filename);
+  free(pad);
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#include "procstat.h"
+
+// Compares the old fopen + fscanf read of /proc/<pid>/stat against the cached
+// fd + pread reader over a set of idle children, the way the scheduler reads
+// them on every tick. Child 0 gets a comm with spaces and parentheses.
+
+#define TRICKY_NAME "a) b (c"
+
+long long now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The per-tick read part5.c used to do
+int read_with_fscanf(pid_t pid, struct proc_stat *stat){
+  char path[40];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *file = fopen(path, "r");
+  if(!file){
+    return -1;
+  }
+  int nice;
+  int matched = fscanf(file, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %d %*d %*d %*d %*d %*d %lu",
+    &stat->utime, &stat->stime, &nice, &stat->vsize);
+  fclose(file);
+  stat->nice = nice;
+  return matched == 4 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+  int count = 500;
+  int rounds = 20;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:r:")) != -1){
+    switch(opt){
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'r':
+        rounds = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n children] [-r rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if(count < 1 || rounds < 1){
+    fprintf(stderr, "Error: need at least one child and one round\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct rlimit limit;
+  if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  pid_t *pids = (pid_t *)malloc(count * sizeof(pid_t));
+  int *fds = (int *)malloc(count * sizeof(int));
+  if(!pids || !fds){
+    perror("Failed to allocate memory for children");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int i = 0; i < count; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      perror("Failed to fork process");
+      exit(EXIT_FAILURE);
+    }else if(pids[i] == 0){
+      if(i == 0){
+        prctl(PR_SET_NAME, TRICKY_NAME);
+      }
+      pause();
+      _exit(0);
+    }
+    fds[i] = open_proc_stat(pids[i]);
+  }
+  usleep(100000); // Let child 0 rename itself
+
+  int fscanf_errors = 0;
+  int pread_errors = 0;
+  struct proc_stat stat;
+
+  long long start = now_ns();
+  for(int r = 0; r < rounds; r++){
+    for(int i = 0; i < count; i++){
+      fscanf_errors += read_with_fscanf(pids[i], &stat) != 0;
+    }
+  }
+  long long fscanf_ns = now_ns() - start;
+
+  start = now_ns();
+  for(int r = 0; r < rounds; r++){
+    for(int i = 0; i < count; i++){
+      pread_errors += read_proc_stat(fds[i], pids[i], &stat) != 0;
+    }
+  }
+  long long pread_ns = now_ns() - start;
+
+  // The tricky comm shifts every field for %s, compare a normal child too
+  struct proc_stat expected, parsed;
+  int normal = count > 1 ? 1 : 0;
+  int agree = read_with_fscanf(pids[normal], &expected) == 0 &&
+    read_proc_stat(fds[normal], pids[normal], &parsed) == 0 &&
+    expected.vsize == parsed.vsize && expected.nice == parsed.nice;
+  int tricky = read_proc_stat(fds[0], pids[0], &parsed) == 0 && parsed.state == 'S';
+
+  long reads = (long)count * rounds;
+  printf("children %d, rounds %d\n", count, rounds);
+  printf("fscanf: %8.0f ns/read, %d failed reads\n", (double)fscanf_ns / reads, fscanf_errors);
+  printf("pread:  %8.0f ns/read, %d failed reads\n", (double)pread_ns / reads, pread_errors);
+  printf("speedup: %0.1fx\n", (double)fscanf_ns / pread_ns);
+  printf("parsers agree on a normal child: %s\n", agree ? "yes" : "no");
+  printf("pread parser handles comm \"%s\": %s\n", TRICKY_NAME, tricky ? "yes" : "no");
+
+  for(int i = 0; i < count; i++){
+    kill(pids[i], SIGKILL);
+    close(fds[i]);
+  }
+  for(int i = 0; i < count; i++){
+    waitpid(pids[i], NULL, 0);
+  }
+  free(pids);
+  free(fds);
+  return 0;
+}
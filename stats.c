@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+
+#include "stats.h"
+#include "sched.h"
+#include "control.h"
+
+#define BATCH 128 // Requests per sendmsg, their replies must all fit the receive buffer
+#define REPLY_SIZE 2048 // A taskstats reply is about 600 bytes
+#define RECEIVE_BUFFER (4 << 20)
+#define RECEIVE_TIMEOUT 100000 // us, a reply lost to a full buffer must not hang the loop
+
+int stats_want_io = 0;
+
+struct stats_source *stats_sources[] = {&taskstats_stats, &proc_stats, &cgroup_stats, &perf_stats, NULL};
+
+static long usec_per_tick;
+
+static int stats_nothing(){
+  usec_per_tick = 1000000 / sysconf(_SC_CLK_TCK);
+  return 0;
+}
+
+// Switches and I/O counters live in their own files, each held open
+static void open_io_files(struct task *task){
+  if(stats_want_io){
+    task->status_fd = open_proc_status(task->pid);
+    task->io_fd = open_proc_io(task->pid);
+  }
+}
+
+static int read_io_files(struct task *task, struct task_stats *stats){
+  if(!stats_want_io){
+    return 0;
+  }
+  if(read_proc_status(task->status_fd, task->pid, &stats->switches) < 0 ||
+     read_proc_io(task->io_fd, task->pid, &stats->io) < 0){
+    return -1;
+  }
+  return 0;
+}
+
+// /proc, one pread() per sample with the fds held open, three for policies
+// that look at I/O
+static int proc_attach(struct task *task){
+  task->stat_fd = open_proc_stat(task->pid);
+  open_io_files(task);
+  return 0;
+}
+
+static int proc_read(struct task *task, struct task_stats *stats){
+  memset(stats, 0, sizeof(*stats));
+  if(read_proc_stat(task->stat_fd, task->pid, &stats->stat) < 0){
+    return -1;
+  }
+  stats->cpu_ns = (long long)(stats->stat.utime + stats->stat.stime) * usec_per_tick * 1000;
+  stats->blkio_ns = (long long)stats->stat.blkio_ticks * usec_per_tick * 1000;
+  if(read_io_files(task, stats) < 0){
+    return -1;
+  }
+  stats->ok = 1;
+  return 0;
+}
+
+static void proc_read_all(struct task **tasks, int count, struct task_stats *stats){
+  for(int i = 0; i < count; i++){
+    stats[i].ok = !tasks[i]->completed && proc_read(tasks[i], &stats[i]) == 0;
+  }
+}
+
+static void proc_release(struct task *task){
+  if(task->stat_fd >= 0){
+    close(task->stat_fd);
+    task->stat_fd = -1;
+  }
+  if(task->status_fd >= 0){
+    close(task->status_fd);
+    task->status_fd = -1;
+  }
+  if(task->io_fd >= 0){
+    close(task->io_fd);
+    task->io_fd = -1;
+  }
+}
+
+struct stats_source proc_stats = {
+  .name = "proc",
+  .open = stats_nothing,
+  .attach = proc_attach,
+  .read = proc_read,
+  .read_all = proc_read_all,
+  .release = proc_release,
+};
+
+// taskstats over generic netlink. Requests carry their position in the batch
+// as the sequence number, which the kernel echoes in the reply or error.
+static int netlink_fd = -1;
+static int family_id;
+static uint32_t next_seq = 1;
+static char *replies;
+
+struct request {
+  struct nlmsghdr header;
+  struct genlmsghdr genl;
+  struct nlattr attr;
+  uint32_t pid;
+};
+
+static struct nlattr *first_attr(struct nlmsghdr *header){
+  return (struct nlattr *)((char *)NLMSG_DATA(header) + GENL_HDRLEN);
+}
+
+static struct nlattr *next_attr(struct nlattr *attr){
+  return (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len));
+}
+
+static int within(struct nlattr *attr, char *end){
+  return (char *)attr + NLA_HDRLEN <= end && attr->nla_len >= NLA_HDRLEN && (char *)attr + attr->nla_len <= end;
+}
+
+static int resolve_family(){
+  struct {
+    struct nlmsghdr header;
+    struct genlmsghdr genl;
+    char attrs[64];
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_type = GENL_ID_CTRL;
+  request.header.nlmsg_flags = NLM_F_REQUEST;
+  request.genl.cmd = CTRL_CMD_GETFAMILY;
+  request.genl.version = 1;
+  struct nlattr *attr = (struct nlattr *)request.attrs;
+  attr->nla_type = CTRL_ATTR_FAMILY_NAME;
+  attr->nla_len = NLA_HDRLEN + sizeof(TASKSTATS_GENL_NAME);
+  memcpy(attr + 1, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+  request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(attr->nla_len);
+
+  if(send(netlink_fd, &request, request.header.nlmsg_len, 0) < 0){
+    return -1;
+  }
+  char buf[REPLY_SIZE];
+  ssize_t len = recv(netlink_fd, buf, sizeof(buf), 0);
+  struct nlmsghdr *header = (struct nlmsghdr *)buf;
+  if(len < (ssize_t)NLMSG_LENGTH(GENL_HDRLEN) || !NLMSG_OK(header, len) || header->nlmsg_type == NLMSG_ERROR){
+    return -1;
+  }
+
+  char *end = buf + header->nlmsg_len;
+  for(attr = first_attr(header); within(attr, end); attr = next_attr(attr)){
+    if(attr->nla_type == CTRL_ATTR_FAMILY_ID){
+      family_id = *(uint16_t *)(attr + 1);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// The family lookup is open to anyone but GET needs CAP_NET_ADMIN, so one
+// request for ourselves tells whether the source is any use
+static int probe_get(){
+  struct request request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = sizeof(request);
+  request.header.nlmsg_type = family_id;
+  request.header.nlmsg_flags = NLM_F_REQUEST;
+  request.header.nlmsg_seq = 0;
+  request.genl.cmd = TASKSTATS_CMD_GET;
+  request.genl.version = 1;
+  request.attr.nla_type = TASKSTATS_CMD_ATTR_PID;
+  request.attr.nla_len = NLA_HDRLEN + sizeof(uint32_t);
+  request.pid = getpid();
+
+  if(send(netlink_fd, &request, sizeof(request), 0) < 0){
+    return -1;
+  }
+  char buf[REPLY_SIZE];
+  ssize_t len = recv(netlink_fd, buf, sizeof(buf), 0);
+  struct nlmsghdr *header = (struct nlmsghdr *)buf;
+  if(len < (ssize_t)NLMSG_HDRLEN || !NLMSG_OK(header, len)){
+    return -1;
+  }
+  if(header->nlmsg_type == NLMSG_ERROR){
+    struct nlmsgerr *error = (struct nlmsgerr *)NLMSG_DATA(header);
+    errno = error->error < 0 ? -error->error : EPROTO;
+    return -1;
+  }
+  return header->nlmsg_type == family_id ? 0 : -1;
+}
+
+static int taskstats_open(){
+  stats_nothing();
+  netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if(netlink_fd < 0){
+    return -1;
+  }
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = RECEIVE_TIMEOUT};
+  int size = RECEIVE_BUFFER;
+  replies = (char *)malloc(BATCH * REPLY_SIZE);
+  if(!replies || bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || resolve_family() < 0 || probe_get() < 0){
+    int saved = errno;
+    close(netlink_fd);
+    netlink_fd = -1;
+    errno = saved;
+    return -1;
+  }
+  // The forced size needs CAP_NET_ADMIN, which taskstats wants anyway
+  if(setsockopt(netlink_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0){
+    setsockopt(netlink_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  setsockopt(netlink_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return 0;
+}
+
+// Unpacks TASKSTATS_TYPE_AGGR_PID { TASKSTATS_TYPE_PID, TASKSTATS_TYPE_STATS }
+static int parse_reply(struct nlmsghdr *header, struct task_stats *stats){
+  char *end = (char *)header + header->nlmsg_len;
+  for(struct nlattr *attr = first_attr(header); within(attr, end); attr = next_attr(attr)){
+    if(attr->nla_type != TASKSTATS_TYPE_AGGR_PID){
+      continue;
+    }
+    char *inner_end = (char *)attr + attr->nla_len;
+    for(struct nlattr *inner = attr + 1; within(inner, inner_end); inner = next_attr(inner)){
+      if(inner->nla_type != TASKSTATS_TYPE_STATS){
+        continue;
+      }
+      // Older kernels send a shorter struct, everything used here is in version 1
+      struct taskstats taskstats;
+      size_t len = inner->nla_len - NLA_HDRLEN;
+      memset(&taskstats, 0, sizeof(taskstats));
+      memcpy(&taskstats, inner + 1, len < sizeof(taskstats) ? len : sizeof(taskstats));
+
+      memset(stats, 0, sizeof(*stats));
+      stats->stat.state = '?';
+      stats->stat.utime = taskstats.ac_utime / usec_per_tick;
+      stats->stat.stime = taskstats.ac_stime / usec_per_tick;
+      stats->stat.nice = (int8_t)taskstats.ac_nice;
+      stats->stat.vsize = taskstats.hiwater_vm * 1024;
+      stats->stat.rss = taskstats.hiwater_rss * 1024 / sysconf(_SC_PAGESIZE);
+      stats->cpu_ns = (long long)(taskstats.ac_utime + taskstats.ac_stime) * 1000;
+      stats->switches.voluntary = taskstats.nvcsw;
+      stats->switches.involuntary = taskstats.nivcsw;
+      stats->blkio_ns = taskstats.blkio_delay_total;
+      stats->io.rchar = taskstats.read_char;
+      stats->io.wchar = taskstats.write_char;
+      stats->io.read_bytes = taskstats.read_bytes;
+      stats->io.write_bytes = taskstats.write_bytes;
+      stats->ok = 1;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static void taskstats_read_all(struct task **tasks, int count, struct task_stats *stats){
+  struct request requests[BATCH];
+  struct mmsghdr messages[BATCH];
+  struct iovec iovecs[BATCH];
+
+  for(int done = 0; done < count; done += BATCH){
+    int batch = count - done < BATCH ? count - done : BATCH;
+    uint32_t base = next_seq;
+    next_seq += batch;
+
+    memset(requests, 0, batch * sizeof(struct request));
+    for(int i = 0; i < batch; i++){
+      stats[done + i].ok = 0;
+      requests[i].header.nlmsg_len = sizeof(struct request);
+      requests[i].header.nlmsg_type = family_id;
+      requests[i].header.nlmsg_flags = NLM_F_REQUEST;
+      requests[i].header.nlmsg_seq = base + i;
+      requests[i].genl.cmd = TASKSTATS_CMD_GET;
+      requests[i].genl.version = 1;
+      requests[i].attr.nla_type = TASKSTATS_CMD_ATTR_PID;
+      requests[i].attr.nla_len = NLA_HDRLEN + sizeof(uint32_t);
+      requests[i].pid = tasks[done + i]->pid;
+    }
+    // The kernel walks every message in one send, each gets one reply
+    if(send(netlink_fd, requests, batch * sizeof(struct request), 0) < 0){
+      continue;
+    }
+
+    int received = 0;
+    while(received < batch){
+      for(int i = 0; i < batch - received; i++){
+        iovecs[i].iov_base = replies + i * REPLY_SIZE;
+        iovecs[i].iov_len = REPLY_SIZE;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+      }
+      int n = recvmmsg(netlink_fd, messages, batch - received, MSG_WAITFORONE, NULL);
+      if(n <= 0){
+        break; // Timed out or overran, whatever is missing is left not ok
+      }
+      for(int i = 0; i < n; i++){
+        struct nlmsghdr *header = (struct nlmsghdr *)iovecs[i].iov_base;
+        if(!NLMSG_OK(header, messages[i].msg_len)){
+          continue;
+        }
+        uint32_t index = header->nlmsg_seq - base;
+        if(index >= (uint32_t)batch){
+          continue; // Straggler from a batch that gave up
+        }
+        received++;
+        if(header->nlmsg_type == family_id){
+          parse_reply(header, &stats[done + index]);
+        }
+      }
+    }
+  }
+}
+
+static int taskstats_read(struct task *task, struct task_stats *stats){
+  taskstats_read_all(&task, 1, stats);
+  return stats->ok ? 0 : -1;
+}
+
+// Nothing per task, requests go by pid
+static int taskstats_attach(struct task *task){
+  return 0;
+}
+
+static void taskstats_release(struct task *task){
+}
+
+struct stats_source taskstats_stats = {
+  .name = "taskstats",
+  .open = taskstats_open,
+  .attach = taskstats_attach,
+  .read = taskstats_read,
+  .read_all = taskstats_read_all,
+  .release = taskstats_release,
+};
+
+// cgroup cpu.stat, in us. Switches and I/O counters still come from /proc
+// when wanted, there is no block I/O delay.
+
+static int cgroup_stats_attach(struct task *task){
+  task->stats_fd = cgroup_open_file(task, "cpu.stat", O_RDONLY);
+  open_io_files(task);
+  return task->stats_fd < 0 ? -1 : 0;
+}
+
+static int cgroup_stats_read(struct task *task, struct task_stats *stats){
+  char buf[1024];
+  memset(stats, 0, sizeof(*stats));
+  ssize_t len = pread(task->stats_fd, buf, sizeof(buf) - 1, 0);
+  if(len <= 0){
+    return -1;
+  }
+  buf[len] = '\0';
+
+  unsigned long long usage = 0, user = 0, system = 0;
+  for(char *line = buf; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL){
+    sscanf(line, "usage_usec %llu", &usage);
+    sscanf(line, "user_usec %llu", &user);
+    sscanf(line, "system_usec %llu", &system);
+  }
+  stats->stat.state = '?';
+  stats->stat.utime = user / usec_per_tick;
+  stats->stat.stime = system / usec_per_tick;
+  stats->cpu_ns = (long long)usage * 1000;
+  if(read_io_files(task, stats) < 0){
+    return -1;
+  }
+  stats->ok = 1;
+  return 0;
+}
+
+static void cgroup_stats_read_all(struct task **tasks, int count, struct task_stats *stats){
+  for(int i = 0; i < count; i++){
+    stats[i].ok = !tasks[i]->completed && cgroup_stats_read(tasks[i], &stats[i]) == 0;
+  }
+}
+
+static void cgroup_stats_release(struct task *task){
+  if(task->stats_fd >= 0){
+    close(task->stats_fd);
+    task->stats_fd = -1;
+  }
+  proc_release(task);
+}
+
+struct stats_source cgroup_stats = {
+  .name = "cgroup",
+  .open = stats_nothing, // part5 checks for -g
+  .attach = cgroup_stats_attach,
+  .read = cgroup_stats_read,
+  .read_all = cgroup_stats_read_all,
+  .release = cgroup_stats_release,
+};
+
+// perf_event_open software counters. task-clock leads the group so one
+// read() returns all four, each summed over the job and its live and exited
+// children thanks to inherit.
+
+static const int perf_configs[PERF_COUNTERS] = {
+  PERF_COUNT_SW_TASK_CLOCK,
+  PERF_COUNT_SW_CONTEXT_SWITCHES,
+  PERF_COUNT_SW_PAGE_FAULTS,
+  PERF_COUNT_SW_CPU_MIGRATIONS,
+};
+
+struct perf_group {
+  uint64_t count; // PERF_COUNTERS
+  uint64_t values[PERF_COUNTERS]; // In perf_configs order
+};
+
+static int open_counter(pid_t pid, int config, int group){
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.inherit = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(SYS_perf_event_open, &attr, pid, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Tries a counter on ourselves, which fails the same way a child's would
+// under perf_event_paranoid or without perf support
+static int perf_open(){
+  int fd = open_counter(0, PERF_COUNT_SW_TASK_CLOCK, -1);
+  if(fd < 0){
+    return -1;
+  }
+  close(fd);
+  return stats_nothing();
+}
+
+// Before the job is released, so the counters see it from its first instruction
+static int perf_attach(struct task *task){
+  task->stats_fd = open_counter(task->pid, perf_configs[0], -1);
+  if(task->stats_fd < 0){
+    fprintf(stderr, "Error: cannot attach perf counters to %d: %s\n", task->pid, strerror(errno));
+    return -1;
+  }
+  for(int i = 1; i < PERF_COUNTERS; i++){
+    task->perf_fds[i - 1] = open_counter(task->pid, perf_configs[i], task->stats_fd);
+    if(task->perf_fds[i - 1] < 0){
+      fprintf(stderr, "Error: cannot attach perf counters to %d: %s\n", task->pid, strerror(errno));
+      return -1;
+    }
+  }
+  return proc_attach(task);
+}
+
+static int perf_read(struct task *task, struct task_stats *stats){
+  struct perf_group group;
+  if(proc_read(task, stats) < 0 ||
+     read(task->stats_fd, &group, sizeof(group)) != sizeof(group) || group.count != PERF_COUNTERS){
+    stats->ok = 0;
+    return -1;
+  }
+  stats->cpu_ns = group.values[0];
+  stats->context_switches = group.values[1];
+  stats->page_faults = group.values[2];
+  stats->migrations = group.values[3];
+  stats->counted = 1;
+  return 0;
+}
+
+static void perf_read_all(struct task **tasks, int count, struct task_stats *stats){
+  for(int i = 0; i < count; i++){
+    stats[i].ok = !tasks[i]->completed && perf_read(tasks[i], &stats[i]) == 0;
+  }
+}
+
+static void perf_release(struct task *task){
+  for(int i = 0; i < PERF_COUNTERS - 1; i++){
+    if(task->perf_fds[i] >= 0){
+      close(task->perf_fds[i]);
+      task->perf_fds[i] = -1;
+    }
+  }
+  if(task->stats_fd >= 0){
+    close(task->stats_fd);
+    task->stats_fd = -1;
+  }
+  proc_release(task);
+}
+
+struct stats_source perf_stats = {
+  .name = "perf",
+  .open = perf_open,
+  .attach = perf_attach,
+  .read = perf_read,
+  .read_all = perf_read_all,
+  .release = perf_release,
+};
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "procstat.h"
+
+struct task;
+
+#define PERF_COUNTERS 4 // In the perf source's group, task-clock and the three counted below
+
+// One task's cumulative counters, from whichever source -S picked
+struct task_stats {
+  int ok; // Filled in, the task may have gone between reap and read
+  struct proc_stat stat; // utime and stime in clock ticks, whatever else the source has
+  long long cpu_ns; // utime + stime at the source's own resolution
+  struct proc_status switches;
+  long long blkio_ns; // Delay waiting on block I/O
+  struct proc_io io;
+  int counted; // The three below are filled in, only the perf source has them
+  long long context_switches; // Voluntary and not, of the job and everything it forked
+  long long page_faults;
+  long long migrations;
+};
+
+// Where samples come from. The proc source reads /proc/<pid>/stat per task,
+// and status and io when the policy wants them. The taskstats source asks
+// the kernel over generic netlink and read_all() batches a whole table into
+// one send and a few receives, at the cost of only having peak rather than
+// current memory figures and no state. It needs CAP_NET_ADMIN; without it
+// open() fails and the proc source is used instead.
+// The cgroup source reads cpu.stat of each job's cgroup, which also counts
+// anything the job forked, and needs -g. The perf source keeps a group of
+// software counters on each job, inherited by whatever it forks, for CPU
+// time in ns rather than clock ticks. It reads the whole group in one
+// read() and takes state and memory from /proc as the proc source does.
+struct stats_source {
+  const char *name;
+  int (*open)(); // Once, before the first attach
+  int (*attach)(struct task *task);
+  int (*read)(struct task *task, struct task_stats *stats);
+  void (*read_all)(struct task **tasks, int count, struct task_stats *stats);
+  void (*release)(struct task *task);
+};
+
+extern struct stats_source proc_stats;
+extern struct stats_source taskstats_stats;
+extern struct stats_source cgroup_stats;
+extern struct stats_source perf_stats;
+extern struct stats_source *stats_sources[];
+extern int stats_want_io; // Whether read() must fill in switches and I/O counters
+
+#endif
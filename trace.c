@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "trace.h"
+#include "sched.h"
+
+#define RING_EVENTS (1 << 16) // 1.5 MB, a power of two so indexes just mask
+#define FLUSH_BATCH (RING_EVENTS / 4) // Wake the writer after this many events
+#define FLUSH_INTERVAL 100 // ms, so a quiet trace still reaches the disk
+
+int tracing = 0;
+
+static struct trace_event *ring;
+static _Atomic uint64_t head; // Next slot the scheduler fills
+static _Atomic uint64_t tail; // Next slot the writer drains
+static _Atomic int stopping;
+static uint64_t last_kick;
+static uint32_t dropped;
+static int trace_fd = -1;
+static int wake_fd = -1;
+static pthread_t writer;
+
+// Writes out everything published so far, in at most two pieces when the
+// range wraps around the end of the ring
+static void drain(){
+  uint64_t from = atomic_load_explicit(&tail, memory_order_relaxed);
+  uint64_t to = atomic_load_explicit(&head, memory_order_acquire);
+
+  while(from < to){
+    uint64_t start = from & (RING_EVENTS - 1);
+    uint64_t count = to - from;
+    if(start + count > RING_EVENTS){
+      count = RING_EVENTS - start;
+    }
+    if(write(trace_fd, &ring[start], count * sizeof(struct trace_event)) < 0){
+      perror("Failed to write trace");
+    }
+    from += count;
+    atomic_store_explicit(&tail, from, memory_order_release);
+  }
+}
+
+static void *writer_main(void *arg){
+  struct pollfd pfd = {.fd = wake_fd, .events = POLLIN};
+  uint64_t kicks;
+
+  while(!atomic_load_explicit(&stopping, memory_order_acquire)){
+    if(poll(&pfd, 1, FLUSH_INTERVAL) > 0){
+      read(wake_fd, &kicks, sizeof(kicks));
+    }
+    drain();
+  }
+  drain();
+  return NULL;
+}
+
+int trace_open(const char *path){
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(trace_fd < 0){
+    perror("Failed to open trace file");
+    return -1;
+  }
+
+  struct trace_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.event_size = sizeof(struct trace_event);
+  if(write(trace_fd, &header, sizeof(header)) != sizeof(header)){
+    perror("Failed to write trace header");
+    return -1;
+  }
+
+  ring = (struct trace_event *)calloc(RING_EVENTS, sizeof(struct trace_event));
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(!ring || wake_fd < 0){
+    perror("Failed to set up trace buffer");
+    return -1;
+  }
+  if(pthread_create(&writer, NULL, writer_main, NULL) != 0){
+    fprintf(stderr, "Error: failed to start trace writer\n");
+    return -1;
+  }
+  tracing = 1;
+  return 0;
+}
+
+// Only ever called from the scheduler loop, so the ring has one producer
+void trace_event(int type, int core, int pid, int64_t arg, int64_t arg2){
+  uint64_t slot = atomic_load_explicit(&head, memory_order_relaxed);
+  if(slot - atomic_load_explicit(&tail, memory_order_acquire) >= RING_EVENTS){
+    dropped++; // The writer is behind, losing events beats stalling a switch
+    return;
+  }
+
+  struct trace_event *event = &ring[slot & (RING_EVENTS - 1)];
+  event->ts = now_ns();
+  event->arg = arg;
+  event->arg2 = arg2;
+  event->pid = pid;
+  event->type = type;
+  event->core = core;
+  atomic_store_explicit(&head, slot + 1, memory_order_release);
+
+  if(slot + 1 - last_kick >= FLUSH_BATCH){
+    uint64_t one = 1;
+    last_kick = slot + 1;
+    write(wake_fd, &one, sizeof(one));
+  }
+}
+
+void trace_close(){
+  if(!tracing){
+    return;
+  }
+  tracing = 0;
+
+  uint64_t one = 1;
+  atomic_store_explicit(&stopping, 1, memory_order_release);
+  write(wake_fd, &one, sizeof(one));
+  pthread_join(writer, NULL);
+
+  pwrite(trace_fd, &dropped, sizeof(dropped), offsetof(struct trace_header, dropped));
+  if(dropped > 0){
+    fprintf(stderr, "Warning: %u trace events dropped\n", dropped);
+  }
+  close(trace_fd);
+  close(wake_fd);
+  free(ring);
+}
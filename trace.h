@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary scheduling trace. Events go into a preallocated ring from the
+// scheduler loop without any syscall, a background thread writes them out
+// in batches. trace2json turns the file into Chrome trace-event JSON.
+
+#define TRACE_MAGIC "P5TRACE1"
+
+enum trace_type {
+  TRACE_DISPATCH = 1, // arg: slice in ns, arg2: dispatch latency in ns or -1
+  TRACE_PREEMPT, // arg: CPU time used in the slice in ns
+  TRACE_EXIT, // arg: wait status
+  TRACE_SLICE, // arg: new slice in ns, arg2: old slice
+  TRACE_SAMPLE, // arg: cumulative utime + stime in ns, arg2: voluntary switches in the slice
+  TRACE_BLOCK, // Taken off the CPU asleep, arg: CPU time used in the slice in ns
+  TRACE_WAKE, // Seen running again while off the CPU, now waiting to be dispatched first
+};
+
+// Fixed size so the file is a plain array after the header
+struct trace_event {
+  int64_t ts; // CLOCK_MONOTONIC ns
+  int64_t arg;
+  int64_t arg2;
+  int32_t pid;
+  uint16_t type;
+  uint16_t core;
+};
+
+struct trace_header {
+  char magic[8];
+  uint32_t event_size;
+  uint32_t dropped; // Events lost to a full ring, filled in on close
+};
+
+int trace_open(const char *path);
+void trace_event(int type, int core, int pid, int64_t arg, int64_t arg2);
+void trace_close();
+
+extern int tracing;
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// Converts a part5 -t trace into Chrome trace-event JSON, loadable in
+// chrome://tracing or Perfetto. Every job is a thread of one "part5"
+// process, so each PID gets its own timeline of run slices. Dispatch
+// latency is also plotted as a counter per core.
+
+#define TABLE_SIZE 65536 // Open addressing over job pids, must be a power of two
+
+struct running {
+  int32_t pid;
+  int open; // A run slice has begun and not ended yet
+};
+
+struct running table[TABLE_SIZE];
+
+struct running *lookup(int32_t pid){
+  uint32_t slot = (uint32_t)pid * 2654435761u;
+  for(int i = 0; i < TABLE_SIZE; i++){
+    struct running *entry = &table[(slot + i) & (TABLE_SIZE - 1)];
+    if(entry->pid == pid || entry->pid == 0){
+      if(entry->pid == 0){
+        entry->pid = pid;
+        // First sighting, name the timeline after the job
+        printf(",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"job %d\"}}", pid, pid);
+      }
+      return entry;
+    }
+  }
+  fprintf(stderr, "Error: more than %d jobs in one trace\n", TABLE_SIZE);
+  exit(EXIT_FAILURE);
+}
+
+// Chrome wants microseconds, keep the ns as the fraction
+void print_event(const char *ph, const char *name, int64_t ts, int32_t pid){
+  printf(",\n{\"ph\": \"%s\", \"name\": \"%s\", \"pid\": 1, \"tid\": %d, \"ts\": %lld.%03lld",
+    ph, name, pid, (long long)(ts / 1000), (long long)(ts % 1000));
+}
+
+int main(int argc, char *argv[]){
+  if(argc != 2){
+    fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *file = fopen(argv[1], "rb");
+  if(!file){
+    perror("Failed to open trace");
+    exit(EXIT_FAILURE);
+  }
+
+  struct trace_header header;
+  if(fread(&header, sizeof(header), 1, file) != 1 ||
+     memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+     header.event_size != sizeof(struct trace_event)){
+    fprintf(stderr, "Error: %s is not a part5 trace\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+  if(header.dropped > 0){
+    fprintf(stderr, "Warning: %u events were dropped while tracing\n", header.dropped);
+  }
+
+  printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  printf("{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"args\": {\"name\": \"part5\"}}");
+
+  struct trace_event event;
+  int64_t base = -1;
+  long count = 0;
+  while(fread(&event, sizeof(event), 1, file) == 1){
+    if(base < 0){
+      base = event.ts;
+    }
+    int64_t ts = event.ts - base;
+    struct running *job = lookup(event.pid);
+    count++;
+
+    switch(event.type){
+      case TRACE_DISPATCH:
+        if(job->open){ // Stopped without a preempt event, close it here
+          print_event("E", "run", ts, event.pid);
+          printf("}");
+        }
+        print_event("B", "run", ts, event.pid);
+        printf(", \"args\": {\"core\": %d, \"slice_us\": %.3f}}", event.core, event.arg / 1000.0);
+        job->open = 1;
+        if(event.arg2 >= 0){
+          printf(",\n{\"ph\": \"C\", \"name\": \"dispatch latency us\", \"pid\": 1, \"ts\": %lld.%03lld, \"args\": {\"core %d\": %.3f}}",
+            (long long)(ts / 1000), (long long)(ts % 1000), event.core, event.arg2 / 1000.0);
+        }
+        break;
+      case TRACE_PREEMPT:
+        if(job->open){
+          print_event("E", "run", ts, event.pid);
+          printf(", \"args\": {\"cpu_us\": %.3f}}", event.arg / 1000.0);
+          job->open = 0;
+        }
+        break;
+      case TRACE_BLOCK:
+        if(job->open){
+          print_event("E", "run", ts, event.pid);
+          printf(", \"args\": {\"cpu_us\": %.3f, \"blocked\": true}}", event.arg / 1000.0);
+          job->open = 0;
+        }
+        break;
+      case TRACE_WAKE:
+        print_event("i", "wake", ts, event.pid);
+        printf(", \"s\": \"t\"}");
+        break;
+      case TRACE_EXIT:
+        if(job->open){
+          print_event("E", "run", ts, event.pid);
+          printf("}");
+          job->open = 0;
+        }
+        print_event("i", "exit", ts, event.pid);
+        printf(", \"s\": \"t\", \"args\": {\"status\": %lld}}", (long long)event.arg);
+        break;
+      case TRACE_SLICE:
+        print_event("i", "slice", ts, event.pid);
+        printf(", \"s\": \"t\", \"args\": {\"from_us\": %.3f, \"to_us\": %.3f}}", event.arg2 / 1000.0, event.arg / 1000.0);
+        break;
+      case TRACE_SAMPLE:
+        print_event("i", "sample", ts, event.pid);
+        printf(", \"s\": \"t\", \"args\": {\"cpu_ms\": %.3f, \"voluntary\": %lld}}", event.arg / 1e6, (long long)event.arg2);
+        break;
+      default:
+        fprintf(stderr, "Warning: unknown event type %u\n", event.type);
+    }
+  }
+  printf("\n]}\n");
+
+  fclose(file);
+  fprintf(stderr, "%ld events\n", count);
+  return 0;
+}
@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "workload.h"
+#include "jobs.h"
+
+#define CHECK_NS 1000000LL // Work between clock reads
+#define MAX_BATCH (1LL << 40)
+#define FP_LENGTH 1024 // Three arrays of it stay in L1
+#define MEMBW_CHUNK (1 << 20)
+#define MAX_PHASES 16
+#define DEFAULT_SIZE (64LL << 20)
+#define DEFAULT_BLOCK 4096
+#define DEFAULT_SLEEP 10000000LL // 10 ms
+#define WAKE_BURST 1000 // alu steps after each wakeup
+
+// xorshift64* step, integer multiply, shifts and xors only
+static inline uint64_t mix(uint64_t x){
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int no_setup(struct workload *w){
+  return 0;
+}
+
+static void no_teardown(struct workload *w){
+}
+
+static long long alu_run(struct workload *w, long long n){
+  uint64_t x = w->seed;
+  for(long long i = 0; i < n; i++){
+    x = mix(x);
+  }
+  w->seed = x;
+  return n;
+}
+
+static int fp_setup(struct workload *w){
+  w->vectors = (double *)malloc(3 * FP_LENGTH * sizeof(double));
+  if(!w->vectors){
+    return -1;
+  }
+  for(int i = 0; i < FP_LENGTH; i++){
+    w->vectors[i] = 0.999 + i * 1e-7; // Below 1, so the values settle rather than overflow
+    w->vectors[FP_LENGTH + i] = 1e-3;
+    w->vectors[2 * FP_LENGTH + i] = 1.0;
+  }
+  return 0;
+}
+
+// Independent multiply-adds across the array, which -O2 turns into SIMD
+static long long fp_run(struct workload *w, long long n){
+  double *a = w->vectors;
+  double *b = a + FP_LENGTH;
+  double *c = b + FP_LENGTH;
+  for(long long k = 0; k < n; k++){
+    for(int i = 0; i < FP_LENGTH; i++){
+      c[i] = c[i] * a[i] + b[i];
+    }
+  }
+  return n * FP_LENGTH * 2;
+}
+
+static void fp_teardown(struct workload *w){
+  free(w->vectors);
+}
+
+// Sattolo's shuffle gives a single cycle, so the chase visits every entry
+// in an order the prefetcher cannot guess
+static int chase_setup(struct workload *w){
+  long long count = w->size / sizeof(uint32_t);
+  if(count < 2 || count > UINT32_MAX){
+    fprintf(stderr, "Error: -size must be between 8 bytes and 16G for chase\n");
+    return -1;
+  }
+  w->chain = (uint32_t *)malloc(count * sizeof(uint32_t));
+  if(!w->chain){
+    return -1;
+  }
+  for(long long i = 0; i < count; i++){
+    w->chain[i] = i;
+  }
+  uint64_t x = w->seed;
+  for(long long i = count - 1; i > 0; i--){
+    x = mix(x);
+    long long j = x % i;
+    uint32_t t = w->chain[i];
+    w->chain[i] = w->chain[j];
+    w->chain[j] = t;
+  }
+  w->cursor = 0;
+  return 0;
+}
+
+// Every load depends on the last, so this runs at memory latency
+static long long chase_run(struct workload *w, long long n){
+  uint32_t p = w->cursor;
+  for(long long i = 0; i < n; i++){
+    p = w->chain[p];
+  }
+  w->cursor = p;
+  return n;
+}
+
+static void chase_teardown(struct workload *w){
+  free(w->chain);
+}
+
+static int membw_setup(struct workload *w){
+  if(w->size < 2 * MEMBW_CHUNK){
+    fprintf(stderr, "Error: -size must be at least 2M for membw\n");
+    return -1;
+  }
+  w->buffer = (char *)malloc(w->size);
+  if(!w->buffer){
+    return -1;
+  }
+  memset(w->buffer, 1, w->size);
+  w->offset = 0;
+  return 0;
+}
+
+// Copies the first half of the buffer over the second a chunk at a time,
+// counting bytes read and written
+static long long membw_run(struct workload *w, long long n){
+  long long half = (w->size / 2) / MEMBW_CHUNK * MEMBW_CHUNK;
+  for(long long i = 0; i < n; i++){
+    memcpy(w->buffer + half + w->offset, w->buffer + w->offset, MEMBW_CHUNK);
+    w->offset = (w->offset + MEMBW_CHUNK) % half;
+  }
+  return n * MEMBW_CHUNK * 2;
+}
+
+static void membw_teardown(struct workload *w){
+  free(w->buffer);
+}
+
+// A private file under -dir, unlinked straight away so it goes however the
+// job ends. O_DIRECT where the filesystem allows it, so I/O reaches the
+// device instead of the page cache.
+static int open_file(struct workload *w, int fill){
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/iobound.%d.XXXXXX", w->dir, getpid());
+  int fd = mkstemp(path);
+  if(fd < 0){
+    fprintf(stderr, "Error: cannot create a file in %s: %s\n", w->dir, strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  if(posix_memalign((void **)&w->buffer, 4096, w->block) != 0){
+    close(fd);
+    return -1;
+  }
+  memset(w->buffer, 'A', w->block);
+
+  // Written through the page cache first, reads of a hole never touch the disk
+  if(fill){
+    for(long long done = 0; done < w->size; done += w->block){
+      if(write(fd, w->buffer, w->block) != w->block){
+        fprintf(stderr, "Error: cannot fill the I/O file: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+      }
+    }
+    fsync(fd);
+  }
+
+  int flags = fcntl(fd, F_GETFL);
+  w->direct = fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+  if(!w->direct){
+    fprintf(stderr, "Warning: no O_DIRECT under %s, I/O goes through the page cache\n", w->dir);
+  }
+  w->fd = fd;
+  w->offset = 0;
+  w->writing = 1;
+  return 0;
+}
+
+static int check_block(struct workload *w){
+  if(w->block < 512 || w->block % 512 != 0 || w->size < w->block){
+    fprintf(stderr, "Error: -block must be a multiple of 512 no larger than -size\n");
+    return -1;
+  }
+  return 0;
+}
+
+static int direct_setup(struct workload *w){
+  return check_block(w) < 0 ? -1 : open_file(w, 0);
+}
+
+// Alternate passes writing then reading the whole file sequentially
+static long long direct_run(struct workload *w, long long n){
+  long long bytes = 0;
+  for(long long i = 0; i < n; i++){
+    ssize_t done = w->writing ? pwrite(w->fd, w->buffer, w->block, w->offset)
+                              : pread(w->fd, w->buffer, w->block, w->offset);
+    if(done > 0){
+      bytes += done;
+    }
+    w->offset += w->block;
+    if(w->offset + w->block > w->size){
+      w->offset = 0;
+      w->writing = !w->writing;
+    }
+  }
+  return bytes;
+}
+
+static void io_teardown(struct workload *w){
+  close(w->fd);
+  free(w->buffer);
+}
+
+static int fsync_setup(struct workload *w){
+  if(check_block(w) < 0 || open_file(w, 0) < 0){
+    return -1;
+  }
+  // Each write must wait for the device through fsync, not O_DIRECT
+  int flags = fcntl(w->fd, F_GETFL);
+  fcntl(w->fd, F_SETFL, flags & ~O_DIRECT);
+  return 0;
+}
+
+// One block then fsync, cycling over the file
+static long long fsync_run(struct workload *w, long long n){
+  for(long long i = 0; i < n; i++){
+    pwrite(w->fd, w->buffer, w->block, w->offset);
+    fsync(w->fd);
+    w->offset = (w->offset + w->block) % (w->size / w->block * w->block);
+  }
+  return n;
+}
+
+static int random_setup(struct workload *w){
+  return check_block(w) < 0 ? -1 : open_file(w, 1);
+}
+
+// Block-aligned offsets all over the file, three reads to each write
+static long long random_run(struct workload *w, long long n){
+  long long blocks = w->size / w->block;
+  for(long long i = 0; i < n; i++){
+    w->seed = mix(w->seed);
+    off_t offset = (off_t)(w->seed % blocks) * w->block;
+    if((w->seed >> 60) % 4 == 0){
+      pwrite(w->fd, w->buffer, w->block, offset);
+    }else{
+      pread(w->fd, w->buffer, w->block, offset);
+    }
+  }
+  return n;
+}
+
+// Sleeps, then computes briefly on waking, like a job waiting on requests
+static long long sleep_run(struct workload *w, long long n){
+  struct timespec ts = {w->sleep_ns / 1000000000LL, w->sleep_ns % 1000000000LL};
+  for(long long i = 0; i < n; i++){
+    nanosleep(&ts, NULL);
+    alu_run(w, WAKE_BURST);
+  }
+  return n;
+}
+
+static struct kernel kernels[] = {
+  {"alu", "int ops", 1, no_setup, alu_run, no_teardown},
+  {"fp", "flops", 1, fp_setup, fp_run, fp_teardown},
+  {"chase", "loads", 1, chase_setup, chase_run, chase_teardown},
+  {"membw", "bytes", 1, membw_setup, membw_run, membw_teardown},
+  {"direct", "bytes", 0, direct_setup, direct_run, io_teardown},
+  {"fsync", "fsyncs", 0, fsync_setup, fsync_run, io_teardown},
+  {"random", "I/Os", 0, random_setup, random_run, io_teardown},
+  {"sleep", "wakeups", 0, no_setup, sleep_run, no_teardown},
+};
+
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+// What each kernel did over the whole run, however many phases it had
+struct kernel_run {
+  struct workload w;
+  int ready; // Set up, torn down at the end
+  long long batch; // Steps per clock read, carried from phase to phase
+  long long units;
+  long long time_ns; // On the kernel's own clock
+};
+
+static struct kernel_run runs[NUM_KERNELS];
+
+static long long read_clock(clockid_t clock){
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int find_kernel(const char *name, size_t len){
+  for(int i = 0; i < NUM_KERNELS; i++){
+    if(strlen(kernels[i].name) == len && strncmp(kernels[i].name, name, len) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Runs one kernel for limit ns of its clock, and returns how long it took
+// on that clock. Batches double until one takes about CHECK_NS.
+static long long run_phase(int k, long long limit){
+  struct kernel *kernel = &kernels[k];
+  struct kernel_run *run = &runs[k];
+  clockid_t clock = kernel->cpu ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_MONOTONIC;
+  long long start = read_clock(clock);
+  long long now = start;
+
+  while(now - start < limit){
+    long long before = now;
+    run->units += kernel->run(&run->w, run->batch);
+    now = read_clock(clock);
+    long long took = now - before;
+    if(took < CHECK_NS / 2 && run->batch < MAX_BATCH){
+      run->batch *= 2;
+    }else if(took > CHECK_NS * 2 && run->batch > 1){
+      run->batch /= 2;
+    }
+  }
+  run->time_ns += now - start;
+  return now - start;
+}
+
+// Flags follow the original single-dash style. -phases takes a list such as
+// "alu:2s,fsync:500ms,sleep:1s", cycled through until -seconds are used up,
+// each phase timed on its kernel's clock.
+int workload_main(int argc, char **argv, const char *default_kernel, int default_seconds, const char *begin){
+  double seconds = default_seconds;
+  const char *kernel_name = default_kernel;
+  const char *phase_list = NULL;
+  struct workload options = {.size = DEFAULT_SIZE, .block = DEFAULT_BLOCK, .dir = ".", .sleep_ns = DEFAULT_SLEEP};
+
+  for(int i = 1; i < argc; i++){
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if(value == NULL){
+      fprintf(stderr, "Illegal flag: `%s'\n", argv[i]);
+      exit(1);
+    }
+    if(strcmp(argv[i], "-seconds") == 0){
+      seconds = atof(value);
+    }else if(strcmp(argv[i], "-kernel") == 0){
+      kernel_name = value;
+    }else if(strcmp(argv[i], "-phases") == 0){
+      phase_list = value;
+    }else if(strcmp(argv[i], "-size") == 0){
+      options.size = parse_size(value);
+    }else if(strcmp(argv[i], "-block") == 0){
+      options.block = parse_size(value);
+    }else if(strcmp(argv[i], "-dir") == 0){
+      options.dir = value;
+    }else if(strcmp(argv[i], "-sleep") == 0){
+      options.sleep_ns = parse_duration(value);
+    }else{
+      fprintf(stderr, "Illegal flag: `%s'\n", argv[i]);
+      exit(1);
+    }
+    i++;
+  }
+  if(seconds <= 0 || options.size <= 0 || options.block <= 0 || options.sleep_ns < 0){
+    fprintf(stderr, "Error: invalid -seconds, -size, -block or -sleep\n");
+    exit(1);
+  }
+
+  int phases[MAX_PHASES];
+  long long lengths[MAX_PHASES];
+  int num_phases = 0;
+  const char *p = phase_list ? phase_list : kernel_name;
+  while(*p && num_phases < MAX_PHASES){
+    size_t len = strcspn(p, ":,");
+    int k = find_kernel(p, len);
+    if(k < 0){
+      fprintf(stderr, "Error: unknown kernel '%.*s' (alu, fp, chase, membw, direct, fsync, random or sleep)\n", (int)len, p);
+      exit(1);
+    }
+    p += len;
+    long long length = -1; // The whole run
+    if(*p == ':'){
+      char duration[32];
+      len = strcspn(++p, ",");
+      snprintf(duration, sizeof(duration), "%.*s", (int)len, p);
+      length = parse_duration(duration);
+      if(length <= 0){
+        fprintf(stderr, "Error: invalid phase length '%s'\n", duration);
+        exit(1);
+      }
+      p += len;
+    }
+    phases[num_phases] = k;
+    lengths[num_phases++] = length;
+    p += *p == ',';
+  }
+
+  for(int i = 0; i < num_phases; i++){
+    struct kernel_run *run = &runs[phases[i]];
+    if(!run->ready){
+      run->w = options;
+      run->w.seed = 0x9E3779B97F4A7C15ULL ^ (uint64_t)getpid();
+      run->batch = 1;
+      if(kernels[phases[i]].setup(&run->w) < 0){
+        fprintf(stderr, "Error: cannot set up the %s kernel\n", kernels[phases[i]].name);
+        exit(1);
+      }
+      run->ready = 1;
+    }
+  }
+
+  printf("Process: %d - %s.\n", getpid(), begin);
+
+  long long budget = (long long)(seconds * 1e9);
+  long long used = 0;
+  long long wall_start = read_clock(CLOCK_MONOTONIC);
+  for(int i = 0; used < budget; i = (i + 1) % num_phases){
+    long long left = budget - used;
+    used += run_phase(phases[i], lengths[i] > 0 && lengths[i] < left ? lengths[i] : left);
+  }
+  double wall = (read_clock(CLOCK_MONOTONIC) - wall_start) / 1e9;
+  double cpu = read_clock(CLOCK_PROCESS_CPUTIME_ID) / 1e9;
+
+  printf("Process: %d - Finished.\n", getpid());
+  for(int k = 0; k < NUM_KERNELS; k++){
+    if(!runs[k].ready){
+      continue;
+    }
+    double time = runs[k].time_ns / 1e9;
+    printf("Process: %d - %s: %lld %s in %.3fs %s, %.4g %s/s\n", getpid(), kernels[k].name,
+      runs[k].units, kernels[k].unit, time, kernels[k].cpu ? "cpu" : "elapsed",
+      time > 0 ? runs[k].units / time : 0.0, kernels[k].unit);
+    kernels[k].teardown(&runs[k].w);
+  }
+  printf("Process: %d - %.3fs elapsed, %.3fs cpu\n", getpid(), wall, cpu);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+
+// The kernels behind cpubound and iobound. Each does a known amount of one
+// kind of work per call and reports it in its own unit, so a run ends with
+// an ops/sec figure rather than just a duration. Work runs in batches sized
+// so the clock is read about once a millisecond, which keeps the timing
+// syscall out of the measurement.
+
+struct workload {
+  long long size; // -size, working set of chase and membw, length of the I/O file
+  long long block; // -block, bytes per I/O
+  const char *dir; // -dir, where the I/O file goes
+  long long sleep_ns; // -sleep, per wakeup of the sleep kernel
+  uint64_t seed;
+  uint32_t *chain; // chase: one random cycle through the working set
+  uint32_t cursor;
+  char *buffer; // membw: the working set, I/O kernels: one aligned block
+  double *vectors; // fp: three arrays of FP_LENGTH
+  int fd; // The I/O file, already unlinked
+  int direct; // Opened with O_DIRECT
+  int writing; // direct: on the write pass
+  long long offset;
+};
+
+struct kernel {
+  const char *name;
+  const char *unit; // What run() counts
+  int cpu; // Timed by CPU time, the others by elapsed time
+  int (*setup)(struct workload *w);
+  long long (*run)(struct workload *w, long long n); // Does n steps, returns units done
+  void (*teardown)(struct workload *w);
+};
+
+int workload_main(int argc, char **argv, const char *default_kernel, int default_seconds, const char *begin);
+
+#endif